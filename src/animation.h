@@ -0,0 +1,157 @@
+#ifndef ANIMATIONH
+#define ANIMATIONH
+
+#include <vector>
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include "sphere.h"
+#include "surface_list.h"
+
+struct CameraKey{
+    int frame;
+    vec3 lookFrom;
+    vec3 lookAt;
+};
+
+struct SphereKey{
+    int frame;
+    vec3 position;
+};
+
+// Keyframed camera path and per-sphere motion. Keys are interpolated linearly
+// and held constant before the first and after the last key.
+class Animation{
+    public:
+        Animation(){}
+
+        void addCameraKey(int frame, const vec3& lookFrom, const vec3& lookAt){
+            CameraKey key = {frame, lookFrom, lookAt};
+            insertKey(cameraKeys, key);
+        }
+
+        void addSphereKey(int sphere, int frame, const vec3& position){
+            SphereKey key = {frame, position};
+            insertKey(sphereKeys[sphere], key);
+        }
+
+        // Adds one camera key per frame, circling lookFrom once around the
+        // vertical axis through lookAt.
+        void orbit(const vec3& lookFrom, const vec3& lookAt, int frames){
+            vec3 offset = lookFrom - lookAt;
+            for(int f = 0; f < frames; ++f){
+                float phi = 2*M_PI*f/frames;
+                vec3 rotated(offset.x()*cos(phi) - offset.z()*sin(phi), offset.y(), offset.x()*sin(phi) + offset.z()*cos(phi));
+                addCameraKey(f, lookAt + rotated, lookAt);
+            }
+        }
+
+        // Reads an animation description, one key per line:
+        //   camera <frame> <fromX> <fromY> <fromZ> <atX> <atY> <atZ>
+        //   sphere <index> <frame> <x> <y> <z>
+        // Empty lines and lines starting with '#' are ignored.
+        bool load(const std::string& filename, std::string& error){
+            std::ifstream in(filename);
+            if(!in){
+                error = "unable to open " + filename;
+                return false;
+            }
+            std::string line;
+            int lineNumber = 0;
+            while(std::getline(in, line)){
+                ++lineNumber;
+                std::istringstream ls(line);
+                std::string type;
+                if(!(ls >> type) || type[0] == '#')
+                    continue;
+                if(type == "camera"){
+                    int frame;
+                    vec3 lookFrom, lookAt;
+                    if(ls >> frame >> lookFrom >> lookAt){
+                        addCameraKey(frame, lookFrom, lookAt);
+                        continue;
+                    }
+                }else if(type == "sphere"){
+                    int sphere, frame;
+                    vec3 position;
+                    if(ls >> sphere >> frame >> position){
+                        addSphereKey(sphere, frame, position);
+                        continue;
+                    }
+                }
+                error = filename + ":" + std::to_string(lineNumber) + ": malformed key '" + line + "'";
+                return false;
+            }
+            return true;
+        }
+
+        bool hasCamera() const{
+            return !cameraKeys.empty();
+        }
+
+        void cameraAt(int frame, vec3& lookFrom, vec3& lookAt) const{
+            if(cameraKeys.empty())
+                return;
+            int k;
+            float t;
+            locate(cameraKeys, frame, k, t);
+            const CameraKey& a = cameraKeys[k];
+            const CameraKey& b = cameraKeys[k+1 < int(cameraKeys.size()) ? k+1 : k];
+            lookFrom = (1-t)*a.lookFrom + t*b.lookFrom;
+            lookAt = (1-t)*a.lookAt + t*b.lookAt;
+        }
+
+        // Moves the keyed spheres of the scene to their positions at the given
+        // frame. The scene is updated in place; unkeyed spheres are untouched.
+        void apply(SurfaceList *scene, int frame) const{
+            for(std::map<int, std::vector<SphereKey> >::const_iterator it = sphereKeys.begin(); it != sphereKeys.end(); ++it){
+                if(it->first < 0 || it->first >= scene->size)
+                    continue;
+                Sphere *sphere = dynamic_cast<Sphere*>(scene->list[it->first]);
+                if(!sphere)
+                    continue;
+                const std::vector<SphereKey>& keys = it->second;
+                int k;
+                float t;
+                locate(keys, frame, k, t);
+                const SphereKey& a = keys[k];
+                const SphereKey& b = keys[k+1 < int(keys.size()) ? k+1 : k];
+                sphere->position = (1-t)*a.position + t*b.position;
+            }
+        }
+
+        std::vector<CameraKey> cameraKeys;
+        std::map<int, std::vector<SphereKey> > sphereKeys;
+
+    private:
+        template<typename Key>
+        static void insertKey(std::vector<Key>& keys, const Key& key){
+            typename std::vector<Key>::iterator it = keys.begin();
+            while(it != keys.end() && it->frame < key.frame)
+                ++it;
+            if(it != keys.end() && it->frame == key.frame)
+                *it = key;
+            else
+                keys.insert(it, key);
+        }
+
+        // Finds the key k with keys[k].frame <= frame < keys[k+1].frame and the
+        // interpolation weight t between them.
+        template<typename Key>
+        static void locate(const std::vector<Key>& keys, int frame, int& k, float& t){
+            k = 0;
+            t = 0;
+            if(frame <= keys.front().frame)
+                return;
+            if(frame >= keys.back().frame){
+                k = keys.size() - 1;
+                return;
+            }
+            while(keys[k+1].frame <= frame)
+                ++k;
+            t = float(frame - keys[k].frame) / float(keys[k+1].frame - keys[k].frame);
+        }
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <zlib.h>
+#include "checksum.h"
+#include "renderer.h"
+#include "sphere.h"
+#include "material.h"
+#include "camera.h"
+#include "sampler.h"
+#include "lodepng/lodepng.h"
+
+// Micro-benchmarks of the hot paths. Every benchmark repeats its operation
+// until at least minSeconds have passed and reports the time per operation
+// and, for operations on buffers, the throughput. The inputs are generated
+// from fixed seeds, so every run measures the same work. Only the benchmarks
+// whose names contain the first argument are run, if one is given.
+
+const double minSeconds = 0.25;
+
+// Number of precomputed inputs the kernels cycle through.
+const int numInputs = 1024;
+
+std::string filter;
+
+// Keeps results alive so that the compiler cannot drop the benchmarked code.
+volatile std::uint64_t sink;
+
+template<typename F>
+void benchmark(const std::string& name, size_t bytesPerOp, F op)
+{
+    if(name.find(filter) == std::string::npos)
+        return;
+    std::uint64_t result = 0;
+    long ops = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    for(long batch = 1; seconds < minSeconds; batch *= 2){
+        for(long i = 0; i < batch; ++i)
+            result += op();
+        ops += batch;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    sink = result;
+
+    std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(14) << seconds * 1e9 / ops << " ns/op";
+    if(bytesPerOp > 0)
+        std::cout << std::setw(12) << bytesPerOp * double(ops) / seconds / (1 << 20) << " MiB/s";
+    std::cout << std::endl;
+}
+
+// Byte-at-a-time CRC-32 as built into lodepng.
+std::uint32_t crc32Bytewise(const unsigned char *data, size_t size)
+{
+    static std::uint32_t table[256];
+    if(!table[1])
+        for(std::uint32_t i = 0; i < 256; ++i){
+            std::uint32_t c = i;
+            for(int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    std::uint32_t crc = 0xffffffffu;
+    for(size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+// Adler-32 with a modulo every 5552 bytes as built into lodepng.
+std::uint32_t adler32Lodepng(const unsigned char *data, size_t size)
+{
+    std::uint32_t s1 = 1, s2 = 0;
+    while(size > 0){
+        size_t amount = size > 5552 ? 5552 : size;
+        size -= amount;
+        for(; amount > 0; --amount){
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+    }
+    return (s2 << 16) | s1;
+}
+
+void benchmarkChecksums()
+{
+    // an IDAT chunk and the filtered scanlines of a 1080p and a 4K frame
+    const size_t sizes[] = {size_t(1) << 16, size_t(1920) * 1080 * 4 + 1080, size_t(3840) * 2160 * 4 + 2160};
+    const char *labels[] = {"64 KiB", "1080p", "4K"};
+    std::vector<unsigned char> data(sizes[2]);
+    srand48(42);
+    for(size_t i = 0; i < data.size(); ++i)
+        data[i] = lrand48() & 0xff;
+
+    for(int s = 0; s < 3; ++s){
+        size_t size = sizes[s];
+        const unsigned char *p = &data[0];
+        std::string label = std::string(" (") + labels[s] + ")";
+        benchmark("crc32 bytewise (lodepng)" + label, size, [&]{ return crc32Bytewise(p, size); });
+        benchmark("crc32 zlib" + label, size, [&]{ return crc32(0, p, size); });
+        benchmark("crc32 slice-by-8" + label, size, [&]{ return crc32SliceBy8(p, size); });
+        benchmark("crc32 computeCrc32" + label, size, [&]{ return computeCrc32(p, size); });
+        benchmark("adler32 (lodepng)" + label, size, [&]{ return adler32Lodepng(p, size); });
+        benchmark("adler32 scalar" + label, size, [&]{ return adler32Scalar(p, size); });
+        benchmark("adler32 zlib" + label, size, [&]{ return adler32(1, p, size); });
+        benchmark("adler32 computeAdler32" + label, size, [&]{ return computeAdler32(p, size); });
+    }
+}
+
+// Bits of a float result, to be added to the sink.
+std::uint64_t bits(float f)
+{
+    std::uint32_t b;
+    std::memcpy(&b, &f, sizeof(b));
+    return b;
+}
+
+std::uint64_t bits(const vec3& v)
+{
+    return bits(v[0]) ^ bits(v[1]) ^ bits(v[2]);
+}
+
+void benchmarkVectors()
+{
+    std::vector<vec3> a(numInputs), b(numInputs);
+    srand48(42);
+    for(int i = 0; i < numInputs; ++i){
+        a[i] = vec3(drand48() - 0.5, drand48() - 0.5, drand48() - 0.5);
+        b[i] = vec3(drand48() - 0.5, drand48() - 0.5, drand48() - 0.5);
+    }
+    int i = 0;
+    benchmark("vec3 add", 0, [&]{ i = (i + 1) & (numInputs - 1); return bits(a[i] + b[i]); });
+    benchmark("vec3 multiply", 0, [&]{ i = (i + 1) & (numInputs - 1); return bits(a[i] * b[i]); });
+    benchmark("vec3 dot", 0, [&]{ i = (i + 1) & (numInputs - 1); return bits(dot(a[i], b[i])); });
+    benchmark("vec3 cross", 0, [&]{ i = (i + 1) & (numInputs - 1); return bits(cross(a[i], b[i])); });
+    benchmark("vec3 length", 0, [&]{ i = (i + 1) & (numInputs - 1); return bits(a[i].length()); });
+    benchmark("vec3 unitVector", 0, [&]{ i = (i + 1) & (numInputs - 1); return bits(unitVector(a[i])); });
+}
+
+void benchmarkSampling()
+{
+    RandomSampler sampler(42);
+    Camera cam(vec3(13,2,3), vec3(0,0,0), vec3(0,1,0), 20, 16.0f/9.0f, 0.1, 10);
+    int i = 0;
+    // a new sample is started every numInputs operations, so the dimension
+    // counter of the sampler stays small
+    auto next = [&]{
+        i = (i + 1) & (numInputs - 1);
+        if(i == 0)
+            sampler.startPixelSample(0, 0, 0);
+    };
+    sampler.startPixelSample(0, 0, 0);
+    benchmark("Sampler::get1D (random)", 0, [&]{ next(); return bits(sampler.get1D()); });
+    benchmark("randomUnitSphere", 0, [&]{ next(); return bits(randomUnitSphere(sampler)); });
+    benchmark("Camera::getRay", 0, [&]{
+        next();
+        Ray r = cam.getRay((i & 31) / 32.0f, (i >> 5) / 32.0f, sampler);
+        return bits(r.getDirection());
+    });
+}
+
+void benchmarkIntersection()
+{
+    // rays from the default camera into the default scene
+    srand48(42);
+    SurfaceList *scene = randomScene(11, 11);
+    RandomSampler sampler(42);
+    Camera cam(vec3(13,2,3), vec3(0,0,0), vec3(0,1,0), 20, 16.0f/9.0f, 0.01, 10);
+    std::vector<Ray> rays(numInputs);
+    for(int i = 0; i < numInputs; ++i){
+        sampler.startPixelSample(i, 0, 0);
+        rays[i] = cam.getRay(drand48(), drand48(), sampler);
+    }
+
+    // the diffuse sphere of radius 1 at (-4, 1, 0), hit by about 5% of these
+    // rays, so that like most sphere tests of SurfaceList::hit the test
+    // usually misses; the ground, list[0], is hit by most of them
+    const Sphere& sphere = *static_cast<Sphere*>(scene->list[scene->size - 2]);
+    int i = 0;
+    hitRecord hitRec;
+    benchmark("Sphere::hit", 0, [&]{
+        i = (i + 1) & (numInputs - 1);
+        return std::uint64_t(sphere.hit(rays[i], 0.001, MAXFLOAT, hitRec));
+    });
+    benchmark("SurfaceList::hit (" + std::to_string(scene->size) + " spheres)", 0, [&]{
+        i = (i + 1) & (numInputs - 1);
+        return std::uint64_t(scene->hit(rays[i], 0.001, MAXFLOAT, hitRec));
+    });
+}
+
+void benchmarkScatter()
+{
+    // the first hits of camera rays, shaded by every material in turn
+    srand48(42);
+    SurfaceList *scene = randomScene(11, 11);
+    RandomSampler sampler(42);
+    Camera cam(vec3(13,2,3), vec3(0,0,0), vec3(0,1,0), 20, 16.0f/9.0f, 0.01, 10);
+    std::vector<Ray> rays;
+    std::vector<hitRecord> hits;
+    while(int(hits.size()) < numInputs){
+        sampler.startPixelSample(hits.size(), 0, 0);
+        Ray r = cam.getRay(drand48(), drand48(), sampler);
+        hitRecord hitRec;
+        if(scene->hit(r, 0.001, MAXFLOAT, hitRec)){
+            rays.push_back(r);
+            hits.push_back(hitRec);
+        }
+    }
+
+    Lambertian lambertian(vec3(0.4, 0.2, 0.1));
+    Metal metal(vec3(0.7, 0.6, 0.5), 0.1);
+    Dielectric dielectric(1.5);
+    const Material *materials[] = {&lambertian, &metal, &dielectric};
+    const char *names[] = {"Lambertian::scatter", "Metal::scatter", "Dielectric::scatter"};
+    for(int m = 0; m < 3; ++m){
+        const Material *mat = materials[m];
+        int i = 0;
+        benchmark(names[m], 0, [&]{
+            i = (i + 1) & (numInputs - 1);
+            sampler.startPixelSample(i, 0, 0);
+            vec3 attenuation;
+            Ray scattered;
+            bool alive = mat->scatter(rays[i], hits[i], attenuation, scattered, sampler);
+            return bits(scattered.getDirection()) + alive;
+        });
+    }
+}
+
+void benchmarkEncode()
+{
+    // a smooth gradient with some noise, similar to a rendered frame
+    const int width = 640, height = 360;
+    std::vector<unsigned char> img(width * height * 4);
+    srand48(42);
+    for(int y = 0; y < height; ++y)
+        for(int x = 0; x < width; ++x){
+            unsigned char *p = &img[(y * width + x) * 4];
+            p[0] = std::min(255, int(x * 255 / width + 8 * drand48()));
+            p[1] = std::min(255, int(y * 255 / height + 8 * drand48()));
+            p[2] = std::min(255, int(128 + 8 * drand48()));
+            p[3] = 255;
+        }
+    benchmark("lodepng::encode (640x360)", img.size(), [&]{
+        std::vector<unsigned char> png;
+        lodepng::encode(png, img, width, height);
+        return std::uint64_t(png.size());
+    });
+}
+
+int main(int argc, const char *argv[])
+{
+    if(argc > 1)
+        filter = argv[1];
+    benchmarkVectors();
+    benchmarkSampling();
+    benchmarkIntersection();
+    benchmarkScatter();
+    benchmarkEncode();
+    benchmarkChecksums();
+    return 0;
+}
@@ -2,13 +2,13 @@
 #define CAMERAH
 
 #include "ray.h"
+#include "sampler.h"
+#include "sampling.h"
 
-vec3 randomUnitDisk(){
-    vec3 p;
-    do{
-        p = 2.0*vec3(drand48(), drand48(),0)-vec3(1,1,0);
-    }while(dot(p,p) >= 1.0);
-    return p;
+inline vec3 randomUnitDisk(Sampler& sampler){
+    float u1, u2;
+    sampler.get2D(u1, u2);
+    return sampleConcentricDisk(u1, u2);
 }
 
 class Camera{
@@ -26,8 +26,8 @@ class Camera{
             horizontal = 2*halfWidth*focusDistance*u;
             vertical = 2*halfHeight*focusDistance*v;
         }
-        Ray getRay(float s, float t){
-            vec3 rd = lensRadius*randomUnitDisk();
+        Ray getRay(float s, float t, Sampler& sampler){
+            vec3 rd = lensRadius*randomUnitDisk(sampler);
             vec3 offset = u*rd.x() + v*rd.y();
             return Ray(origin + offset, lowerLeftCorner + s*horizontal + t*vertical - origin - offset);
         }
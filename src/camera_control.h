@@ -0,0 +1,121 @@
+#ifndef CAMERACONTROLH
+#define CAMERACONTROLH
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <math.h>
+#include "vec3.h"
+
+// Camera parameters of the interactive mode.
+struct CameraView{
+    vec3 lookFrom;
+    vec3 lookAt;
+    float vfov;
+    float aperture;
+    float focalDistance;
+};
+
+// The camera of the interactive mode, moved by the preview thread and read by
+// the renderer. Every change increments the version, so the renderer notices
+// that its view is outdated and restarts.
+class CameraControl{
+    public:
+        CameraControl(const CameraView& view) : current(view), version(0), saveRequested(false){}
+
+        // Returns the current view and its version.
+        CameraView view(unsigned& viewVersion) const{
+            std::lock_guard<std::mutex> lock(mutex);
+            viewVersion = version;
+            return current;
+        }
+
+        unsigned getVersion() const{
+            std::lock_guard<std::mutex> lock(mutex);
+            return version;
+        }
+
+        // Moves the camera and its target along the view direction, to the
+        // right and upwards, in units of a twentieth of their distance.
+        void move(float forward, float right, float up){
+            update([=](CameraView& v){
+                vec3 direction = v.lookAt - v.lookFrom;
+                float step = 0.05f * direction.length();
+                vec3 w = unitVector(direction);
+                vec3 u = unitVector(cross(w, vec3(0, 1, 0)));
+                vec3 offset = step * (forward * w + right * u + up * vec3(0, 1, 0));
+                v.lookFrom += offset;
+                v.lookAt += offset;
+            });
+        }
+
+        // Orbits the camera around its target by yaw and pitch in radians.
+        void orbit(float yaw, float pitch){
+            update([=](CameraView& v){
+                vec3 offset = v.lookFrom - v.lookAt;
+                float distance = offset.length();
+                float theta = acosf(std::max(-1.0f, std::min(1.0f, offset.y() / distance)));
+                float phi = atan2f(offset.z(), offset.x());
+                theta = std::max(0.01f, std::min(float(M_PI) - 0.01f, theta - pitch));
+                phi += yaw;
+                v.lookFrom = v.lookAt + distance * vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi));
+            });
+        }
+
+        void zoom(float factor){
+            update([=](CameraView& v){
+                v.vfov = std::max(1.0f, std::min(170.0f, v.vfov * factor));
+            });
+        }
+
+        void scaleAperture(float factor){
+            update([=](CameraView& v){
+                v.aperture = std::max(0.001f, v.aperture * factor);
+            });
+        }
+
+        void scaleFocalDistance(float factor){
+            update([=](CameraView& v){
+                v.focalDistance = std::max(0.01f, v.focalDistance * factor);
+            });
+        }
+
+        // Asks the renderer to save the current image.
+        void requestSave(){
+            std::lock_guard<std::mutex> lock(mutex);
+            saveRequested = true;
+            changed.notify_all();
+        }
+
+        bool takeSaveRequest(){
+            std::lock_guard<std::mutex> lock(mutex);
+            bool requested = saveRequested;
+            saveRequested = false;
+            return requested;
+        }
+
+        // Waits until the view differs from viewVersion, a save is requested
+        // or the timeout has passed.
+        void waitForChange(unsigned viewVersion, std::chrono::milliseconds timeout){
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait_for(lock, timeout, [this, viewVersion]{ return version != viewVersion || saveRequested; });
+        }
+
+    private:
+        template<typename F>
+        void update(F change){
+            std::lock_guard<std::mutex> lock(mutex);
+            change(current);
+            ++version;
+            changed.notify_all();
+        }
+
+        CameraView current;
+        unsigned version;
+        bool saveRequested;
+        mutable std::mutex mutex;
+        std::condition_variable changed;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "checksum.h"
+#include "lodepng/lodepng.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+namespace {
+
+// Tables of the reflected CRC-32 polynomial 0xedb88320: table[0] is the
+// classic byte table, table[k] advances a byte by k more zero bytes.
+struct Crc32Tables{
+    std::uint32_t table[8][256];
+
+    Crc32Tables(){
+        for(std::uint32_t i = 0; i < 256; ++i){
+            std::uint32_t c = i;
+            for(int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[0][i] = c;
+        }
+        for(int i = 0; i < 256; ++i)
+            for(int k = 1; k < 8; ++k)
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+    }
+};
+
+const Crc32Tables crcTables;
+
+// Continues the non-inverted CRC state crc over data.
+std::uint32_t crc32Tables(std::uint32_t crc, const unsigned char *data, size_t size){
+    const std::uint32_t (*t)[256] = crcTables.table;
+    for(; size > 0 && (reinterpret_cast<std::uintptr_t>(data) & 7); --size)
+        crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    for(; size >= 8; size -= 8, data += 8){
+        std::uint32_t lo = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | std::uint32_t(data[3]) << 24);
+        std::uint32_t hi = data[4] | data[5] << 8 | data[6] << 16 | std::uint32_t(data[7]) << 24;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    }
+    for(; size > 0; --size)
+        crc = t[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef CHECKSUM_X86
+// Folding with carry-less multiplications after Gopal et al., "Fast CRC
+// Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Intel,
+// 2009). Four 128 bit lanes are folded over 64 bytes at a time, then into one
+// lane and finally reduced to 32 bits with a Barrett reduction. size has to be
+// a multiple of 16 and at least 64.
+__attribute__((target("pclmul,sse4.1")))
+std::uint32_t crc32Pclmul(std::uint32_t crc, const unsigned char *data, size_t size){
+    alignas(16) static const std::uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static const std::uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static const std::uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static const std::uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+    __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+    __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+    __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+    __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+    data += 64;
+    size -= 64;
+
+    while(size >= 64){
+        __m128i y1 = _mm_clmulepi64_si128(x1, k, 0x00);
+        __m128i y2 = _mm_clmulepi64_si128(x2, k, 0x00);
+        __m128i y3 = _mm_clmulepi64_si128(x3, k, 0x00);
+        __m128i y4 = _mm_clmulepi64_si128(x4, k, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, y1), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, y2), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, y3), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, y4), _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30)));
+        data += 64;
+        size -= 64;
+    }
+
+    // fold the four lanes into one, then the remaining 16 byte blocks
+    k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+    __m128i lanes[3] = {x2, x3, x4};
+    for(int i = 0; i < 3; ++i){
+        __m128i y = _mm_clmulepi64_si128(x1, k, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), y);
+    }
+    while(size >= 16){
+        __m128i y = _mm_clmulepi64_si128(x1, k, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data))), y);
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 to 64 bits
+    __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x00), x2);
+
+    // Barrett reduction to 32 bits
+    k = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k, 0x10);
+    x2 = _mm_clmulepi64_si128(_mm_and_si128(x2, mask), k, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return _mm_extract_epi32(x1, 1);
+}
+
+bool detectPclmul(){
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+const bool hasPclmul = detectPclmul();
+#endif
+
+// Largest number of bytes whose sums cannot overflow 32 bits before the
+// modulo, as in zlib.
+const size_t adlerBlock = 5552;
+const std::uint32_t adlerBase = 65521;
+
+} // namespace
+
+std::uint32_t crc32SliceBy8(const unsigned char *data, size_t size, std::uint32_t previous){
+    return ~crc32Tables(~previous, data, size);
+}
+
+std::uint32_t computeCrc32(const unsigned char *data, size_t size, std::uint32_t previous){
+    std::uint32_t crc = ~previous;
+#ifdef CHECKSUM_X86
+    if(hasPclmul && size >= 64){
+        size_t folded = size & ~size_t(15);
+        crc = crc32Pclmul(crc, data, folded);
+        data += folded;
+        size -= folded;
+    }
+#endif
+    return ~crc32Tables(crc, data, size);
+}
+
+std::uint32_t adler32Scalar(const unsigned char *data, size_t size, std::uint32_t previous){
+    std::uint32_t a = previous & 0xffff;
+    std::uint32_t b = previous >> 16;
+    while(size > 0){
+        size_t n = size < adlerBlock ? size : adlerBlock;
+        size -= n;
+        for(; n > 0; --n){
+            a += *data++;
+            b += a;
+        }
+        a %= adlerBase;
+        b %= adlerBase;
+    }
+    return b << 16 | a;
+}
+
+std::uint32_t computeAdler32(const unsigned char *data, size_t size, std::uint32_t previous){
+#ifdef CHECKSUM_X86
+    std::uint32_t a = previous & 0xffff;
+    std::uint32_t b = previous >> 16;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weightsLow = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i weightsHigh = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    while(size >= 16){
+        // blocks of 16 bytes: a grows by the sum of the bytes, b by n times
+        // the a before the block plus the bytes weighted by their distance
+        // to the end of the block
+        size_t n = (size < adlerBlock ? size : adlerBlock) & ~size_t(15);
+        size -= n;
+        std::uint64_t sumB = b + std::uint64_t(n) * a;
+        __m128i prefix = zero;
+        __m128i sum = zero;
+        __m128i weighted = zero;
+        for(; n > 0; n -= 16, data += 16){
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            prefix = _mm_add_epi32(prefix, sum);
+            sum = _mm_add_epi32(sum, _mm_sad_epu8(bytes, zero));
+            weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpacklo_epi8(bytes, zero), weightsLow));
+            weighted = _mm_add_epi32(weighted, _mm_madd_epi16(_mm_unpackhi_epi8(bytes, zero), weightsHigh));
+        }
+        alignas(16) std::uint32_t lanes[3][4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes[0]), prefix);
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes[1]), sum);
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes[2]), weighted);
+        std::uint64_t sumA = a + std::uint64_t(lanes[1][0]) + lanes[1][2];
+        sumB += 16 * (std::uint64_t(lanes[0][0]) + lanes[0][2]);
+        sumB += std::uint64_t(lanes[2][0]) + lanes[2][1] + lanes[2][2] + lanes[2][3];
+        a = sumA % adlerBase;
+        b = sumB % adlerBase;
+    }
+    return adler32Scalar(data, size, b << 16 | a);
+#else
+    return adler32Scalar(data, size, previous);
+#endif
+}
+
+unsigned lodepng_crc32(const unsigned char *data, size_t length){
+    return computeCrc32(data, length);
+}
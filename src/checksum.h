@@ -0,0 +1,22 @@
+#ifndef CHECKSUMH
+#define CHECKSUMH
+
+#include <cstddef>
+#include <cstdint>
+
+// Checksums of the PNG pipeline. computeCrc32 folds 64 bytes per iteration
+// with carry-less multiplications on CPUs with PCLMULQDQ and falls back to
+// slice-by-8 tables elsewhere; it also replaces lodepng's byte-at-a-time
+// lodepng_crc32 (lodepng is built with LODEPNG_NO_COMPILE_CRC).
+// computeAdler32 sums 16 bytes per step with SSE2 on x86.
+// Both continue the checksum of the preceding data passed in as previous,
+// computeCrc32(data, size) equals zlib's crc32(0, data, size) and
+// computeAdler32(data, size) equals adler32(1, data, size).
+std::uint32_t computeCrc32(const unsigned char *data, size_t size, std::uint32_t previous = 0);
+std::uint32_t computeAdler32(const unsigned char *data, size_t size, std::uint32_t previous = 1);
+
+// Portable versions, for comparison.
+std::uint32_t crc32SliceBy8(const unsigned char *data, size_t size, std::uint32_t previous = 0);
+std::uint32_t adler32Scalar(const unsigned char *data, size_t size, std::uint32_t previous = 1);
+
+#endif
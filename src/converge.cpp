@@ -0,0 +1,220 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <boost/program_options.hpp>
+#include "renderer.h"
+#include "hdr.h"
+#include "scenes.h"
+
+namespace po = boost::program_options;
+
+// Equal-time comparison of samplers and integrators: renders canonical scenes
+// in passes of doubling sample counts, measures the error of every pass
+// against a high-spp reference and reports the time until a target error is
+// reached and the error reached within a time budget.
+
+// The references are rendered with the random sampler, a different seed and
+// sample indices far from those of the passes, so their noise is independent
+// of the image they are compared with.
+const int referenceSeed = 1000003;
+const int referenceFirstSample = 1 << 24;
+
+// Root mean square difference of the gamma-corrected colors in [0, 1], as
+// stored in the images.
+double rmse(const std::vector<vec3>& image, const std::vector<vec3>& reference)
+{
+    double sum = 0;
+    for(size_t i = 0; i < image.size(); ++i)
+        for(int c = 0; c < 3; ++c){
+            double a = std::sqrt(std::min(1.0f, std::max(0.0f, image[i][c])));
+            double b = std::sqrt(std::min(1.0f, std::max(0.0f, reference[i][c])));
+            sum += (a - b) * (a - b);
+        }
+    return std::sqrt(sum / (3.0 * image.size()));
+}
+
+struct ConvergencePoint{
+    int samples;
+    double seconds;
+    double rmse;
+};
+
+// Interpolates log(y) linearly in log(x) between two points.
+double logInterpolate(double x, double x0, double y0, double x1, double y1)
+{
+    double t = (std::log(x) - std::log(x0)) / (std::log(x1) - std::log(x0));
+    return std::exp(std::log(y0) + t * (std::log(y1) - std::log(y0)));
+}
+
+// Time at which the curve reaches target, or a negative value if it does not.
+double timeToRmse(const std::vector<ConvergencePoint>& curve, double target)
+{
+    for(size_t i = 0; i < curve.size(); ++i){
+        if(curve[i].rmse > target)
+            continue;
+        if(i == 0)
+            return curve[0].seconds;
+        return logInterpolate(target, curve[i - 1].rmse, curve[i - 1].seconds, curve[i].rmse, curve[i].seconds);
+    }
+    return -1;
+}
+
+// Error reached after seconds, or a negative value if the curve ends before.
+double rmseAtTime(const std::vector<ConvergencePoint>& curve, double seconds)
+{
+    for(size_t i = 0; i < curve.size(); ++i){
+        if(curve[i].seconds < seconds)
+            continue;
+        if(i == 0)
+            return curve[0].rmse;
+        return logInterpolate(seconds, curve[i - 1].seconds, curve[i - 1].rmse, curve[i].seconds, curve[i].rmse);
+    }
+    return -1;
+}
+
+int main(int argc, const char *argv[])
+{
+    std::string sceneNames;
+    std::string referenceDir;
+    bool updateReferences;
+    int referenceSamples;
+    int maxSamples;
+    double targetRmse;
+    double timeBudget;
+    std::string csvFile;
+    RenderSettings settings;
+
+    po::options_description desc("Equal-time convergence benchmark of the ray tracer\n\nSupported parameters");
+    desc.add_options()
+    ("help", "print available parameters")
+    ("scenes", po::value<std::string>(&sceneNames)->default_value("default,glass,large"), "comma separated scenes: default, glass (half of the small spheres of glass) and large (3600 small spheres)")
+    ("width", po::value<int>(&settings.width)->default_value(160), "width of the rendered images")
+    ("height", po::value<int>(&settings.height)->default_value(90), "height of the rendered images")
+    ("sampler", po::value<std::string>(&settings.sampler)->default_value("random"), "sample generator: random, sobol, halton or bluenoise")
+    ("integrator", po::value<std::string>(&settings.integrator)->default_value("recursive"), "path tracer: recursive or wavefront")
+    ("reorder", po::bool_switch(&settings.reorder)->default_value(false), "sort the scattered rays of every bounce (wavefront integrator)")
+    ("threads", po::value<int>(&settings.threads)->default_value(0), "number of render threads, 0 for all cores")
+    ("max-spp", po::value<int>(&maxSamples)->default_value(256), "samples per pixel of the last pass; the passes double the samples from 1")
+    ("target-rmse", po::value<double>(&targetRmse)->default_value(0.02), "error for the time-to-target measurement")
+    ("time", po::value<double>(&timeBudget)->default_value(1.0), "time budget in seconds for the error-at-time measurement")
+    ("references", po::value<std::string>(&referenceDir)->default_value("references"), "directory of the reference images, <scene>_<width>x<height>.pfm")
+    ("reference-spp", po::value<int>(&referenceSamples)->default_value(4096), "samples per pixel of new references")
+    ("update-references", po::bool_switch(&updateReferences)->default_value(false), "render the references again even if they exist")
+    ("csv", po::value<std::string>(&csvFile), "also write the curves as CSV file: scene, spp, seconds, rmse");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if(vm.count("help")){
+        std::cout << desc << std::endl;
+        return 1;
+    }
+    settings.seed = 42;
+    std::string error;
+    if(!settings.validate(error) || maxSamples <= 0 || referenceSamples <= 0){
+        std::cerr << (error.empty() ? "the sample counts have to be positive" : error) << std::endl;
+        return 1;
+    }
+
+    std::ofstream csv;
+    if(vm.count("csv")){
+        csv.open(csvFile);
+        csv << "scene,spp,seconds,rmse" << std::endl;
+    }
+
+    mkdir(referenceDir.c_str(), 0777);
+    std::vector<double> timesToTarget;
+    int numScenes = 0;
+    std::stringstream names(sceneNames);
+    std::string name;
+    while(std::getline(names, name, ',')){
+        ++numScenes;
+        TestScene scene;
+        if(!createTestScene(name, scene)){
+            std::cerr << "Unknown scene '" << name << "'" << std::endl;
+            return 1;
+        }
+
+        std::ostringstream referenceName;
+        referenceName << referenceDir << "/" << name << "_" << settings.width << "x" << settings.height << ".pfm";
+        std::vector<vec3> reference;
+        double seconds;
+        if(updateReferences || !readPfm(referenceName.str(), settings.width, settings.height, reference)){
+            std::cout << "Rendering the reference of " << name << " with " << referenceSamples << " spp" << std::endl;
+            RenderSettings referenceSettings = settings;
+            referenceSettings.sampler = "random";
+            referenceSettings.seed = referenceSeed;
+            referenceSettings.firstSample = referenceFirstSample;
+            referenceSettings.numRaysPixel = referenceSamples;
+            if(!renderTestScene(scene, referenceSettings, reference, seconds)){
+                std::cerr << "unable to render the reference of " << name << std::endl;
+                return 1;
+            }
+            if(!writePfm(referenceName.str(), settings.width, settings.height, reference))
+                std::cerr << "unable to write the reference to " << referenceName.str() << std::endl;
+        }
+
+        // every pass adds as many samples as all passes before, the image is
+        // the running mean of the passes
+        std::cout << "scene " << name << " (" << scene.surfaces->size << " spheres), sampler " << settings.sampler
+                  << ", integrator " << settings.integrator << ", " << settings.width << "x" << settings.height << std::endl;
+        std::cout << "    spp     seconds      rmse" << std::endl;
+        std::vector<ConvergencePoint> curve;
+        std::vector<vec3> mean(size_t(settings.width) * settings.height, vec3(0, 0, 0));
+        std::vector<vec3> pass;
+        double totalSeconds = 0;
+        for(int samples = 0; samples < maxSamples;){
+            RenderSettings passSettings = settings;
+            passSettings.firstSample = samples;
+            passSettings.numRaysPixel = std::min(std::max(samples, 1), maxSamples - samples);
+            if(!renderTestScene(scene, passSettings, pass, seconds)){
+                std::cerr << "unable to render " << name << std::endl;
+                return 1;
+            }
+            int total = samples + passSettings.numRaysPixel;
+            for(size_t i = 0; i < mean.size(); ++i)
+                mean[i] = (float(samples) * mean[i] + float(passSettings.numRaysPixel) * pass[i]) / float(total);
+            samples = total;
+            totalSeconds += seconds;
+
+            ConvergencePoint point = {samples, totalSeconds, rmse(mean, reference)};
+            curve.push_back(point);
+            std::cout << std::setw(7) << point.samples << std::fixed << std::setprecision(3) << std::setw(12) << point.seconds
+                      << std::setprecision(5) << std::setw(10) << point.rmse << std::endl;
+            if(csv.is_open())
+                csv << name << "," << point.samples << "," << point.seconds << "," << point.rmse << std::endl;
+        }
+
+        double timeToTarget = timeToRmse(curve, targetRmse);
+        double rmseAtBudget = rmseAtTime(curve, timeBudget);
+        std::cout << std::setprecision(3) << "time to rmse " << targetRmse << ": ";
+        if(timeToTarget >= 0){
+            std::cout << timeToTarget << " s" << std::endl;
+            timesToTarget.push_back(timeToTarget);
+        }else{
+            std::cout << "not reached with " << maxSamples << " spp" << std::endl;
+        }
+        std::cout << "rmse at " << timeBudget << " s: ";
+        if(rmseAtBudget >= 0)
+            std::cout << std::setprecision(5) << rmseAtBudget << std::endl;
+        else
+            std::cout << "not reached with " << maxSamples << " spp" << std::endl;
+        std::cout << std::endl;
+    }
+
+    // the geometric mean weights every scene alike, whatever its cost
+    if(!timesToTarget.empty()){
+        double logSum = 0;
+        for(size_t i = 0; i < timesToTarget.size(); ++i)
+            logSum += std::log(timesToTarget[i]);
+        std::cout << std::setprecision(3) << "Geometric mean time to rmse " << targetRmse << ": " << std::exp(logSum / timesToTarget.size()) << " s over "
+                  << timesToTarget.size() << " of " << numScenes << " scene(s)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#ifndef DENOISEH
+#define DENOISEH
+
+#include <vector>
+#include <algorithm>
+#include "framebuffer.h"
+
+// Edge-avoiding a-trous wavelet filter after Dammertz et al., "Edge-Avoiding
+// A-Trous Wavelet Transform for fast Global Illumination Filtering" (HPG 2010).
+// The radiance is divided by the first-hit albedo, so that only the
+// illumination is blurred and textures stay sharp. Every iteration applies a
+// 5x5 B3-spline kernel with holes of 2^i pixels whose weights drop across
+// edges in the illumination, normal, depth and albedo buffers.
+class Denoiser{
+    public:
+        // Beyond 10 iterations the holes of the kernel, 2^9 pixels and more,
+        // are wider than any sensible image.
+        static const int maxIterations = 10;
+
+        Denoiser() : iterations(5), sigmaColor(0.6), sigmaNormal(0.6), sigmaDepth(0.1), sigmaAlbedo(0.2){}
+
+        void apply(Framebuffer& fb) const{
+            const int tileSize = 32;
+            int width = fb.width;
+            int height = fb.height;
+            int tilesX = (width + tileSize - 1) / tileSize;
+            int tilesY = (height + tileSize - 1) / tileSize;
+
+            std::vector<vec3> illumination(width*height);
+            for(int i = 0; i < width*height; ++i)
+                illumination[i] = fb.radiance[i] / demodulation(fb.albedo[i]);
+            std::vector<vec3> filtered(width*height);
+
+            float sigmaC = sigmaColor;
+            for(int iteration = 0; iteration < iterations; ++iteration){
+                int step = 1 << iteration;
+
+                #pragma omp parallel for schedule(dynamic)
+                for(int tile = 0; tile < tilesX*tilesY; ++tile){
+                    int x0 = (tile % tilesX) * tileSize;
+                    int y0 = (tile / tilesX) * tileSize;
+                    for(int y = y0; y < std::min(height, y0 + tileSize); ++y)
+                        for(int x = x0; x < std::min(width, x0 + tileSize); ++x)
+                            filtered[y*width + x] = filterPixel(fb, illumination, x, y, step, sigmaC);
+                }
+
+                illumination.swap(filtered);
+                // finer details are removed at the first levels, the color
+                // weight becomes stricter for the wider ones
+                sigmaC *= 0.5f;
+            }
+
+            for(int i = 0; i < width*height; ++i)
+                fb.radiance[i] = illumination[i] * demodulation(fb.albedo[i]);
+        }
+
+        int iterations;
+        float sigmaColor;
+        float sigmaNormal;
+        float sigmaDepth;
+        float sigmaAlbedo;
+
+    private:
+        static vec3 demodulation(const vec3& albedo){
+            return vec3(std::max(albedo[0], 0.01f), std::max(albedo[1], 0.01f), std::max(albedo[2], 0.01f));
+        }
+
+        vec3 filterPixel(const Framebuffer& fb, const std::vector<vec3>& illumination, int x, int y, int step, float sigmaC) const{
+            static const float kernel[5] = {1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16};
+            int width = fb.width;
+            int height = fb.height;
+            int p = y*width + x;
+            const vec3& cp = illumination[p];
+            const vec3& np = fb.normal[p];
+            const vec3& ap = fb.albedo[p];
+            float zp = fb.depth[p];
+
+            vec3 sum(0, 0, 0);
+            float weightSum = 0;
+            for(int j = -2; j <= 2; ++j){
+                int qy = y + j*step;
+                if(qy < 0 || qy >= height)
+                    continue;
+                for(int i = -2; i <= 2; ++i){
+                    int qx = x + i*step;
+                    if(qx < 0 || qx >= width)
+                        continue;
+                    int q = qy*width + qx;
+                    float wc = (illumination[q] - cp).squaredLength() / (sigmaC*sigmaC);
+                    float wn = (fb.normal[q] - np).squaredLength() / (sigmaNormal*sigmaNormal);
+                    float wa = (fb.albedo[q] - ap).squaredLength() / (sigmaAlbedo*sigmaAlbedo);
+                    float wz = depthDistance(zp, fb.depth[q]) / sigmaDepth;
+                    float w = kernel[i + 2] * kernel[j + 2] * expf(-wc - wn - wa - wz);
+                    sum += w * illumination[q];
+                    weightSum += w;
+                }
+            }
+            return sum / weightSum;
+        }
+
+        // Relative difference of two depths; pixels that both see the sky are
+        // at the same depth, a pixel on the sky never mixes with a surface.
+        static float depthDistance(float a, float b){
+            if(a == MAXFLOAT || b == MAXFLOAT)
+                return a == b ? 0 : MAXFLOAT;
+            return fabsf(a - b) / std::max(std::min(a, b), 1e-3f);
+        }
+};
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef EXRH
+#define EXRH
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+struct ExrChannel{
+    std::string name;
+    // width*height values, the first row is the top of the image
+    std::vector<float> data;
+};
+
+// Minimal OpenEXR writer: a single-part scanline file without compression
+// holding any number of 32 bit float channels. As every scanline has the same
+// size the file can be written line by line in any order once it is opened.
+class ExrWriter{
+    public:
+        ExrWriter() : width(0), height(0){}
+
+        // Writes the header and the offset table. bottomUp selects the
+        // DECREASING_Y line order, in which the bottom line comes first.
+        bool open(const std::string& filename, int w, int h, const std::vector<std::string>& channelNames, bool bottomUp){
+            width = w;
+            height = h;
+            lineOrder = bottomUp ? 1 : 0;
+
+            // channels are stored in alphabetical order of their names
+            order.resize(channelNames.size());
+            for(size_t c = 0; c < order.size(); ++c)
+                order[c] = c;
+            std::sort(order.begin(), order.end(), [&channelNames](int a, int b){ return channelNames[a] < channelNames[b]; });
+
+            std::vector<char> header;
+            putInt(header, 20000630);
+            putInt(header, 2);
+
+            std::vector<char> chlist;
+            for(size_t c = 0; c < order.size(); ++c){
+                putString(chlist, channelNames[order[c]]);
+                putInt(chlist, 2); // FLOAT
+                putInt(chlist, 0); // pLinear and reserved
+                putInt(chlist, 1); // xSampling
+                putInt(chlist, 1); // ySampling
+            }
+            chlist.push_back(0);
+            putAttribute(header, "channels", "chlist", chlist);
+
+            std::vector<char> value;
+            value.push_back(0); // NO_COMPRESSION
+            putAttribute(header, "compression", "compression", value);
+
+            value.clear();
+            putInt(value, 0);
+            putInt(value, 0);
+            putInt(value, width - 1);
+            putInt(value, height - 1);
+            putAttribute(header, "dataWindow", "box2i", value);
+            putAttribute(header, "displayWindow", "box2i", value);
+
+            value.assign(1, char(lineOrder));
+            putAttribute(header, "lineOrder", "lineOrder", value);
+
+            value.clear();
+            putFloat(value, 1);
+            putAttribute(header, "pixelAspectRatio", "float", value);
+
+            value.clear();
+            putFloat(value, 0);
+            putFloat(value, 0);
+            putAttribute(header, "screenWindowCenter", "v2f", value);
+
+            value.clear();
+            putFloat(value, 1);
+            putAttribute(header, "screenWindowWidth", "float", value);
+            header.push_back(0);
+
+            out.open(filename, std::ios::binary);
+            if(!out)
+                return false;
+            out.write(&header[0], header.size());
+
+            // offset table with one entry per scanline, each chunk holds the
+            // line number, its size and the line of every channel
+            lineSize = uint64_t(width) * 4 * order.size();
+            firstChunk = header.size() + uint64_t(height) * 8;
+            std::vector<char> table;
+            for(int y = 0; y < height; ++y)
+                putUInt64(table, chunkOffset(y));
+            out.write(&table[0], table.size());
+            return bool(out);
+        }
+
+        // Writes scanline y (0 is the top) from values holding width floats per
+        // channel, in the order of the names passed to open.
+        void writeLine(int y, const float *values){
+            line.clear();
+            putInt(line, y);
+            putInt(line, int(lineSize));
+            for(size_t c = 0; c < order.size(); ++c)
+                for(int x = 0; x < width; ++x)
+                    putFloat(line, values[size_t(order[c]) * width + x]);
+            out.seekp(chunkOffset(y));
+            out.write(&line[0], line.size());
+        }
+
+        bool close(){
+            out.close();
+            return !out.fail();
+        }
+
+        static bool write(const std::string& filename, int width, int height, const std::vector<ExrChannel>& channels){
+            std::vector<std::string> names(channels.size());
+            for(size_t c = 0; c < channels.size(); ++c)
+                names[c] = channels[c].name;
+            ExrWriter writer;
+            if(!writer.open(filename, width, height, names, false))
+                return false;
+            std::vector<float> values(channels.size() * width);
+            for(int y = 0; y < height; ++y){
+                for(size_t c = 0; c < channels.size(); ++c)
+                    std::copy(channels[c].data.begin() + size_t(y) * width, channels[c].data.begin() + size_t(y + 1) * width, values.begin() + c * width);
+                writer.writeLine(y, &values[0]);
+            }
+            return writer.close();
+        }
+
+    private:
+        uint64_t chunkOffset(int y) const{
+            int index = lineOrder == 1 ? height - 1 - y : y;
+            return firstChunk + uint64_t(index) * (8 + lineSize);
+        }
+
+        static void putInt(std::vector<char>& out, int32_t v){
+            for(int i = 0; i < 4; ++i)
+                out.push_back(char((uint32_t(v) >> (8*i)) & 0xff));
+        }
+
+        static void putUInt64(std::vector<char>& out, uint64_t v){
+            for(int i = 0; i < 8; ++i)
+                out.push_back(char((v >> (8*i)) & 0xff));
+        }
+
+        static void putFloat(std::vector<char>& out, float f){
+            uint32_t bits;
+            std::memcpy(&bits, &f, 4);
+            putInt(out, int32_t(bits));
+        }
+
+        static void putString(std::vector<char>& out, const std::string& s){
+            out.insert(out.end(), s.begin(), s.end());
+            out.push_back(0);
+        }
+
+        static void putAttribute(std::vector<char>& out, const std::string& name, const std::string& type, const std::vector<char>& value){
+            putString(out, name);
+            putString(out, type);
+            putInt(out, int(value.size()));
+            out.insert(out.end(), value.begin(), value.end());
+        }
+
+        int width;
+        int height;
+        int lineOrder;
+        std::vector<int> order;
+        uint64_t lineSize;
+        uint64_t firstChunk;
+        std::ofstream out;
+        std::vector<char> line;
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef FRAMEBUFFERH
+#define FRAMEBUFFERH
+
+#include <vector>
+#include <cstdint>
+#include "vec3.h"
+#include "integrator.h"
+#include "exr.h"
+
+// Linear radiance of a frame, averaged over the samples of each pixel, and
+// optionally the per-pixel features that guide the denoiser and are written as
+// arbitrary output variables (AOVs). Pixels are stored in render coordinates,
+// the first row is the bottom of the frame. For streamed frames only a window
+// of numRows rows is held, row y of the frame is stored in row y % numRows;
+// denoising, the AOVs and toImage need the whole frame. The render cost of
+// every pixel is recorded for heatmaps once enableCost is called.
+class Framebuffer{
+    public:
+        Framebuffer() : width(0), height(0), rows(0), features(false), cost(false){}
+
+        void resize(int w, int h, bool withFeatures, int numRows = 0){
+            width = w;
+            height = h;
+            rows = numRows > 0 && numRows < h ? numRows : h;
+            features = withFeatures;
+            size_t size = size_t(w) * rows;
+            radiance.assign(size, vec3(0, 0, 0));
+            if(features){
+                albedo.assign(size, vec3(0, 0, 0));
+                normal.assign(size, vec3(0, 0, 0));
+                depth.assign(size, MAXFLOAT);
+                materialId.assign(size, -1);
+                primitiveId.assign(size, -1);
+                bounces.assign(size, 0);
+                samples.assign(size, 0);
+            }
+            if(cost)
+                enableCost();
+        }
+
+        void enableCost(){
+            cost = true;
+            seconds.assign(size_t(width) * rows, 0);
+            rays.assign(size_t(width) * rows, 0);
+        }
+
+        bool hasCost() const{
+            return cost;
+        }
+
+        void setCost(int x, int y, float pixelSeconds, int pixelRays){
+            size_t i = index(x, y);
+            seconds[i] = pixelSeconds;
+            rays[i] = pixelRays;
+        }
+
+        size_t index(int x, int y) const{
+            return size_t(y % rows)*width + x;
+        }
+
+        bool hasFeatures() const{
+            return features;
+        }
+
+        void setFeatures(int x, int y, const PixelFeatures& pixel){
+            size_t i = index(x, y);
+            albedo[i] = pixel.albedoSum / float(pixel.samples);
+            normal[i] = pixel.normalSum / float(pixel.samples);
+            depth[i] = pixel.minDepth;
+            materialId[i] = pixel.materialId;
+            primitiveId[i] = pixel.primitiveId;
+            bounces[i] = float(pixel.bounceSum) / pixel.samples;
+            samples[i] = pixel.samples;
+        }
+
+        // Resets the features of a pixel that is not rendered to those of a
+        // new framebuffer.
+        void clearFeatures(int x, int y){
+            size_t i = index(x, y);
+            albedo[i] = vec3(0, 0, 0);
+            normal[i] = vec3(0, 0, 0);
+            depth[i] = MAXFLOAT;
+            materialId[i] = -1;
+            primitiveId[i] = -1;
+            bounces[i] = 0;
+            samples[i] = 0;
+        }
+
+        // Writes the gamma-corrected radiance into an 8 bit RGBA image.
+        void toImage(std::vector<std::uint8_t> *img) const{
+            #pragma omp parallel for
+            for(int y = 0; y < height; ++y)
+                for(int x = 0; x < width; ++x)
+                    storePixel(img, width, height, x, y, radiance[y*width + x]);
+        }
+
+        // Writes the linear radiance and all features as one multi-channel EXR
+        // file: R, G, B, Z, N.X, N.Y, N.Z, albedo.R, albedo.G, albedo.B,
+        // materialId, primitiveId, bounces and samples. Pixels seeing the sky
+        // have id -1.
+        bool writeAovs(const std::string& filename) const{
+            const char *names[] = {"R", "G", "B", "Z", "N.X", "N.Y", "N.Z", "albedo.R", "albedo.G", "albedo.B",
+                                   "materialId", "primitiveId", "bounces", "samples"};
+            const int numChannels = sizeof(names) / sizeof(names[0]);
+            std::vector<ExrChannel> channels(numChannels);
+            for(int c = 0; c < numChannels; ++c){
+                channels[c].name = names[c];
+                channels[c].data.resize(width*height);
+            }
+            for(int y = 0; y < height; ++y){
+                for(int x = 0; x < width; ++x){
+                    int i = y*width + x;
+                    int o = (height - y - 1)*width + x;
+                    float values[numChannels] = {radiance[i][0], radiance[i][1], radiance[i][2], depth[i],
+                                                 normal[i][0], normal[i][1], normal[i][2], albedo[i][0], albedo[i][1], albedo[i][2],
+                                                 float(materialId[i]), float(primitiveId[i]), bounces[i], float(samples[i])};
+                    for(int c = 0; c < numChannels; ++c)
+                        channels[c].data[o] = values[c];
+                }
+            }
+            return ExrWriter::write(filename, width, height, channels);
+        }
+
+        int width;
+        int height;
+        int rows;
+        bool features;
+        bool cost;
+        std::vector<vec3> radiance;
+        std::vector<vec3> albedo;
+        std::vector<vec3> normal;
+        std::vector<float> depth;
+        std::vector<int> materialId;
+        std::vector<int> primitiveId;
+        std::vector<float> bounces;
+        std::vector<int> samples;
+        // render time and number of rays traced of every pixel, over all samples
+        std::vector<float> seconds;
+        std::vector<int> rays;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef HDRH
+#define HDRH
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include "vec3.h"
+#include "exr.h"
+
+// Streaming writer for the linear radiance of a frame. Rows are passed in
+// render coordinates, in any order, as soon as they are final.
+class HdrWriter{
+    public:
+        virtual ~HdrWriter(){}
+        virtual bool open(const std::string& filename, int width, int height) = 0;
+        virtual void writeRow(int y, const vec3 *row) = 0;
+        virtual bool close() = 0;
+};
+
+// Converts the bits of a float between host and little endian byte order.
+inline uint32_t swapLittleEndian(uint32_t bits){
+    const uint16_t one = 1;
+    if(*reinterpret_cast<const uint8_t*>(&one) == 0)
+        bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) | (bits << 24);
+    return bits;
+}
+
+// Portable float map: a short text header followed by little endian RGB
+// floats stored from the bottom row to the top one. All rows have the same
+// size, so every row is written at its place in the file.
+class PfmWriter : public HdrWriter{
+    public:
+        virtual bool open(const std::string& filename, int w, int h){
+            width = w;
+            out.open(filename, std::ios::binary);
+            out << "PF\n" << w << " " << h << "\n-1.0\n";
+            firstRow = out.tellp();
+            return bool(out);
+        }
+
+        virtual void writeRow(int y, const vec3 *row){
+            line.resize(3 * width);
+            for(int x = 0; x < width; ++x)
+                for(int c = 0; c < 3; ++c)
+                    line[3*x + c] = toLittleEndian(row[x][c]);
+            out.seekp(firstRow + std::streamoff(y) * width * 12);
+            out.write(reinterpret_cast<const char*>(&line[0]), line.size() * 4);
+        }
+
+        virtual bool close(){
+            out.close();
+            return !out.fail();
+        }
+
+    private:
+        static uint32_t toLittleEndian(float f){
+            uint32_t bits;
+            std::memcpy(&bits, &f, 4);
+            return swapLittleEndian(bits);
+        }
+
+        int width;
+        std::streamoff firstRow;
+        std::ofstream out;
+        std::vector<uint32_t> line;
+};
+
+// Uncompressed RGB float EXR in bottom-up line order.
+class ExrHdrWriter : public HdrWriter{
+    public:
+        virtual bool open(const std::string& filename, int w, int h){
+            width = w;
+            height = h;
+            std::vector<std::string> names;
+            names.push_back("R");
+            names.push_back("G");
+            names.push_back("B");
+            return writer.open(filename, w, h, names, true);
+        }
+
+        virtual void writeRow(int y, const vec3 *row){
+            line.resize(3 * width);
+            for(int x = 0; x < width; ++x)
+                for(int c = 0; c < 3; ++c)
+                    line[c*width + x] = row[x][c];
+            writer.writeLine(height - 1 - y, &line[0]);
+        }
+
+        virtual bool close(){
+            return writer.close();
+        }
+
+    private:
+        int width;
+        int height;
+        ExrWriter writer;
+        std::vector<float> line;
+};
+
+// Writes a whole image, the first row at the top, as PFM file.
+inline bool writePfm(const std::string& filename, int width, int height, const std::vector<vec3>& image){
+    PfmWriter writer;
+    if(!writer.open(filename, width, height))
+        return false;
+    for(int y = 0; y < height; ++y)
+        writer.writeRow(y, &image[size_t(height - 1 - y) * width]);
+    return writer.close();
+}
+
+// Reads a little endian PFM file of the given size as written by PfmWriter,
+// the first row of image at the top.
+inline bool readPfm(const std::string& filename, int width, int height, std::vector<vec3>& image){
+    std::ifstream in(filename, std::ios::binary);
+    std::string magic;
+    int w, h;
+    float scale;
+    if(!(in >> magic >> w >> h >> scale) || magic != "PF" || w != width || h != height || scale >= 0)
+        return false;
+    in.get();
+    std::vector<uint32_t> data(size_t(3) * width * height);
+    if(!in.read(reinterpret_cast<char*>(&data[0]), data.size() * 4))
+        return false;
+    image.resize(size_t(width) * height);
+    for(int y = 0; y < height; ++y)
+        for(int x = 0; x < width; ++x){
+            const uint32_t *p = &data[(size_t(height - 1 - y) * width + x) * 3];
+            for(int c = 0; c < 3; ++c){
+                uint32_t bits = swapLittleEndian(p[c]);
+                std::memcpy(&image[size_t(y) * width + x][c], &bits, 4);
+            }
+        }
+    return true;
+}
+
+// Returns the writer for the extension of filename (.pfm or .exr) or nullptr.
+inline HdrWriter* createHdrWriter(const std::string& filename){
+    size_t dot = filename.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : filename.substr(dot);
+    if(extension == ".pfm")
+        return new PfmWriter();
+    if(extension == ".exr")
+        return new ExrHdrWriter();
+    return nullptr;
+}
+
+#endif
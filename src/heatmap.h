@@ -0,0 +1,91 @@
+#ifndef HEATMAPH
+#define HEATMAPH
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include "vec3.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "exr.h"
+
+// False-color images of the render cost per pixel, to find the materials and
+// regions that are expensive to render.
+class Heatmap{
+    public:
+        // Colors of the ramp from cheap to expensive: black, purple, red,
+        // orange and light yellow.
+        static vec3 ramp(float t){
+            static const vec3 stops[] = {vec3(0, 0, 0.02), vec3(0.34, 0.06, 0.43), vec3(0.73, 0.21, 0.33), vec3(0.98, 0.55, 0.04), vec3(0.99, 1.0, 0.64)};
+            const int numStops = sizeof(stops) / sizeof(stops[0]);
+            t = std::max(0.0f, std::min(1.0f, t)) * (numStops - 1);
+            int i = std::min(int(t), numStops - 2);
+            float f = t - i;
+            return (1 - f) * stops[i] + f * stops[i + 1];
+        }
+
+        // The cost of every pixel, the first row at the top: its render time
+        // in seconds, or the number of rays if rays is set.
+        static std::vector<float> cost(const Framebuffer& fb, bool rays){
+            std::vector<float> values(size_t(fb.width) * fb.height);
+            for(int y = 0; y < fb.height; ++y)
+                for(int x = 0; x < fb.width; ++x){
+                    size_t i = fb.index(x, y);
+                    values[size_t(fb.height - y - 1) * fb.width + x] = rays ? float(fb.rays[i]) : fb.seconds[i];
+                }
+            return values;
+        }
+
+        // Writes the cost as false-color image in the format of the
+        // extension of filename. The colors are scaled to the 99th percentile
+        // of the cost, so a few outliers do not hide the rest; more expensive
+        // pixels are drawn in the brightest color. Returns that percentile in
+        // scale.
+        static bool write(const std::string& filename, const Framebuffer& fb, bool rays, float& scale, std::string& error){
+            std::unique_ptr<ImageWriter> writer(createImageWriter(imageFormat(filename)));
+            if(!writer){
+                error = "unknown image format of " + filename;
+                return false;
+            }
+            std::vector<float> values = cost(fb, rays);
+            std::vector<float> sorted(values);
+            size_t percentile = sorted.size() * 99 / 100;
+            std::nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+            scale = sorted[percentile];
+
+            std::vector<std::uint8_t> img(values.size() * 4);
+            for(size_t i = 0; i < values.size(); ++i){
+                vec3 col = ramp(scale > 0 ? values[i] / scale : 0);
+                img[4*i] = std::uint8_t(255.99f * col[0]);
+                img[4*i + 1] = std::uint8_t(255.99f * col[1]);
+                img[4*i + 2] = std::uint8_t(255.99f * col[2]);
+                img[4*i + 3] = 255;
+            }
+            return writer->write(filename, img, fb.width, fb.height, error);
+        }
+
+        // Writes the raw cost, the channels seconds and rays, as EXR file.
+        static bool writeData(const std::string& filename, const Framebuffer& fb){
+            std::vector<ExrChannel> channels(2);
+            channels[0].name = "seconds";
+            channels[0].data = cost(fb, false);
+            channels[1].name = "rays";
+            channels[1].data = cost(fb, true);
+            return ExrWriter::write(filename, fb.width, fb.height, channels);
+        }
+
+        // The file of the raw data of the heatmap filename: its extension
+        // replaced by _data.exr, so it never overwrites the image, not even
+        // an image named .exr.
+        static std::string dataFilename(const std::string& filename){
+            size_t dot = filename.find_last_of('.');
+            size_t slash = filename.find_last_of('/');
+            if(dot == std::string::npos || (slash != std::string::npos && dot < slash))
+                dot = filename.size();
+            return filename.substr(0, dot) + "_data.exr";
+        }
+};
+
+#endif
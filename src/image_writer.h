@@ -0,0 +1,404 @@
+#ifndef IMAGEWRITERH
+#define IMAGEWRITERH
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <zlib.h>
+#include "png.h"
+
+// Writes 8 bit RGBA frames to files. A frame is either written at once or
+// streamed row by row from the top of the image: open, writeRow for every
+// row, close. On failure open, close and write return false and set error.
+class ImageWriter{
+    public:
+        virtual ~ImageWriter(){}
+        virtual bool open(const std::string& filename, int width, int height, std::string& error) = 0;
+        // Appends the next row of width RGBA pixels.
+        virtual void writeRow(const std::uint8_t *row) = 0;
+        virtual bool close(std::string& error) = 0;
+
+        // Writes img, whose first row is the top of the image.
+        virtual bool write(const std::string& filename, const std::vector<std::uint8_t>& img, int width, int height, std::string& error){
+            if(!open(filename, width, height, error))
+                return false;
+            for(int y = 0; y < height; ++y)
+                writeRow(&img[4 * size_t(width) * y]);
+            return close(error);
+        }
+
+    protected:
+        bool openFile(const std::string& filename, std::string& error){
+            out.open(filename, std::ios::binary);
+            if(!out){
+                error = "unable to write " + filename;
+                return false;
+            }
+            name = filename;
+            return true;
+        }
+
+        void put(const void *data, size_t size){
+            out.write(static_cast<const char*>(data), size);
+        }
+
+        bool closeFile(std::string& error){
+            out.close();
+            if(out.fail()){
+                error = "unable to write " + name;
+                return false;
+            }
+            return true;
+        }
+
+        std::ofstream out;
+        std::string name;
+};
+
+// PNG with lodepng's filter heuristic and automatic color type, deflated by
+// parallelZlib. The fast profile keeps RGBA, skips the filters and deflates
+// with the fastest zlib level. Streamed frames are RGBA, filtered per row
+// with the same heuristic and deflated by zlib as the rows arrive.
+class PngWriter : public ImageWriter{
+    public:
+        PngWriter(bool fast) : fast(fast){}
+
+        virtual bool write(const std::string& filename, const std::vector<std::uint8_t>& img, int width, int height, std::string& error){
+            lodepng::State state;
+            state.encoder.zlibsettings.custom_zlib = parallelZlib;
+            const int fastLevel = 1;
+            if(fast){
+                state.encoder.zlibsettings.custom_context = &fastLevel;
+                state.encoder.filter_strategy = LFS_ZERO;
+                state.encoder.auto_convert = 0;
+            }
+            std::vector<std::uint8_t> png;
+            unsigned code = lodepng::encode(png, img, width, height, state);
+            if(code){
+                error = std::string("encoder error: ") + lodepng_error_text(code);
+                return false;
+            }
+            if(!openFile(filename, error))
+                return false;
+            put(&png[0], png.size());
+            return closeFile(error);
+        }
+
+        virtual bool open(const std::string& filename, int w, int h, std::string& error){
+            width = w;
+            if(!openFile(filename, error))
+                return false;
+            const unsigned char signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+            put(signature, 8);
+
+            chunk.assign(4, 0);
+            putUInt32(chunk, w);
+            putUInt32(chunk, h);
+            chunk.push_back(8); // bits per channel
+            chunk.push_back(6); // RGBA
+            chunk.push_back(0); // deflate
+            chunk.push_back(0); // adaptive filters
+            chunk.push_back(0); // no interlacing
+            writeChunk("IHDR");
+
+            stream = z_stream();
+            deflateInit(&stream, fast ? 1 : Z_DEFAULT_COMPRESSION);
+            previous.assign(4 * size_t(w), 0);
+            filtered.resize(1 + 4 * size_t(w));
+            candidate.resize(filtered.size());
+            chunk.assign(4, 0);
+            return true;
+        }
+
+        virtual void writeRow(const std::uint8_t *row){
+            size_t size = 4 * size_t(width);
+            if(fast){
+                filterRow(0, row, filtered);
+            }else{
+                // the filter with the smallest sum of absolute differences
+                unsigned long best = ~0ul;
+                for(int type = 0; type < 5; ++type){
+                    unsigned long sum = filterRow(type, row, candidate);
+                    if(sum < best){
+                        best = sum;
+                        filtered.swap(candidate);
+                    }
+                }
+            }
+            std::copy(row, row + size, previous.begin());
+            deflateChunks(&filtered[0], filtered.size(), Z_NO_FLUSH);
+        }
+
+        virtual bool close(std::string& error){
+            deflateChunks(nullptr, 0, Z_FINISH);
+            deflateEnd(&stream);
+            if(chunk.size() > 4)
+                writeChunk("IDAT");
+            chunk.assign(4, 0);
+            writeChunk("IEND");
+            return closeFile(error);
+        }
+
+    private:
+        static const size_t chunkSize = 1 << 16;
+
+        // Filters row with the PNG filter type into out and returns the sum
+        // of the absolute values of the filtered bytes.
+        unsigned long filterRow(int type, const std::uint8_t *row, std::vector<std::uint8_t>& out) const{
+            size_t size = 4 * size_t(width);
+            const std::uint8_t *up = &previous[0];
+            out[0] = type;
+            unsigned long sum = 0;
+            for(size_t i = 0; i < size; ++i){
+                int a = i >= 4 ? row[i - 4] : 0;
+                int b = up[i];
+                int c = i >= 4 ? up[i - 4] : 0;
+                int prediction = 0;
+                if(type == 1)
+                    prediction = a;
+                else if(type == 2)
+                    prediction = b;
+                else if(type == 3)
+                    prediction = (a + b) / 2;
+                else if(type == 4){
+                    int p = a + b - c;
+                    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                    prediction = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                }
+                std::uint8_t value = row[i] - prediction;
+                out[1 + i] = value;
+                sum += value < 128 ? value : 256 - value;
+            }
+            return sum;
+        }
+
+        // Deflates data into IDAT chunks of chunkSize bytes.
+        void deflateChunks(const std::uint8_t *data, size_t size, int flush){
+            stream.next_in = const_cast<std::uint8_t*>(data);
+            stream.avail_in = size;
+            int status = Z_OK;
+            do{
+                size_t used = chunk.size();
+                chunk.resize(4 + chunkSize);
+                stream.next_out = &chunk[used];
+                stream.avail_out = chunk.size() - used;
+                status = deflate(&stream, flush);
+                chunk.resize(chunk.size() - stream.avail_out);
+                if(chunk.size() == 4 + chunkSize){
+                    writeChunk("IDAT");
+                    chunk.assign(4, 0);
+                }
+            }while(stream.avail_in > 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+        }
+
+        // Writes the chunk whose data follows the four bytes reserved for
+        // the type in chunk.
+        void writeChunk(const char *type){
+            std::copy(type, type + 4, chunk.begin());
+            std::vector<std::uint8_t> length;
+            putUInt32(length, chunk.size() - 4);
+            put(&length[0], 4);
+            put(&chunk[0], chunk.size());
+            std::vector<std::uint8_t> crc;
+            putUInt32(crc, lodepng_crc32(&chunk[0], chunk.size()));
+            put(&crc[0], 4);
+        }
+
+        static void putUInt32(std::vector<std::uint8_t>& out, std::uint32_t v){
+            for(int i = 3; i >= 0; --i)
+                out.push_back((v >> (8*i)) & 0xff);
+        }
+
+        bool fast;
+        int width;
+        z_stream stream;
+        std::vector<std::uint8_t> previous;
+        std::vector<std::uint8_t> filtered;
+        std::vector<std::uint8_t> candidate;
+        std::vector<std::uint8_t> chunk;
+};
+
+// "Quite OK Image" format (https://qoiformat.org): a single pass over the
+// pixels with runs, a 64 entry color cache and small deltas to the previous
+// pixel. Files are somewhat larger than PNG, but encode an order of
+// magnitude faster.
+class QoiWriter : public ImageWriter{
+    public:
+        virtual bool open(const std::string& filename, int w, int h, std::string& error){
+            width = w;
+            if(!openFile(filename, error))
+                return false;
+            std::uint8_t header[14] = {'q', 'o', 'i', 'f'};
+            putUInt32(header + 4, w);
+            putUInt32(header + 8, h);
+            header[12] = 4; // RGBA
+            header[13] = 0; // sRGB with linear alpha
+            put(header, 14);
+
+            std::fill(index, index + 64, 0);
+            prev = packPixel(0, 0, 0, 255);
+            run = 0;
+            // worst case: five bytes per pixel
+            encoded.resize(5 * size_t(w) + 1);
+            return true;
+        }
+
+        virtual void writeRow(const std::uint8_t *row){
+            std::uint8_t *o = &encoded[0];
+            for(int x = 0; x < width; ++x){
+                const std::uint8_t *px = row + 4*x;
+                std::uint32_t current = packPixel(px[0], px[1], px[2], px[3]);
+                if(current == prev){
+                    ++run;
+                    if(run == 62){
+                        *o++ = 0xc0 | (run - 1);
+                        run = 0;
+                    }
+                    continue;
+                }
+                if(run > 0){
+                    *o++ = 0xc0 | (run - 1);
+                    run = 0;
+                }
+
+                int hash = (px[0]*3 + px[1]*5 + px[2]*7 + px[3]*11) % 64;
+                if(index[hash] == current){
+                    *o++ = hash;
+                }else{
+                    index[hash] = current;
+                    if(px[3] == (prev >> 24)){
+                        signed char dr = px[0] - (prev & 0xff);
+                        signed char dg = px[1] - ((prev >> 8) & 0xff);
+                        signed char db = px[2] - ((prev >> 16) & 0xff);
+                        signed char drg = dr - dg;
+                        signed char dbg = db - dg;
+                        if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1){
+                            *o++ = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                        }else if(dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7){
+                            *o++ = 0x80 | (dg + 32);
+                            *o++ = (drg + 8) << 4 | (dbg + 8);
+                        }else{
+                            *o++ = 0xfe;
+                            *o++ = px[0];
+                            *o++ = px[1];
+                            *o++ = px[2];
+                        }
+                    }else{
+                        *o++ = 0xff;
+                        for(int c = 0; c < 4; ++c)
+                            *o++ = px[c];
+                    }
+                }
+                prev = current;
+            }
+            put(&encoded[0], o - &encoded[0]);
+        }
+
+        virtual bool close(std::string& error){
+            if(run > 0){
+                std::uint8_t op = 0xc0 | (run - 1);
+                put(&op, 1);
+            }
+            const std::uint8_t end[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+            put(end, 8);
+            return closeFile(error);
+        }
+
+    private:
+        static void putUInt32(std::uint8_t *out, std::uint32_t v){
+            for(int i = 3; i >= 0; --i)
+                *out++ = (v >> (8*i)) & 0xff;
+        }
+
+        static std::uint32_t packPixel(std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint8_t a){
+            return r | g << 8 | b << 16 | std::uint32_t(a) << 24;
+        }
+
+        int width;
+        std::uint32_t index[64];
+        std::uint32_t prev;
+        int run;
+        std::vector<std::uint8_t> encoded;
+};
+
+// Binary portable pixmap (P6): a text header followed by the RGB bytes.
+class PpmWriter : public ImageWriter{
+    public:
+        virtual bool open(const std::string& filename, int w, int h, std::string& error){
+            width = w;
+            if(!openFile(filename, error))
+                return false;
+            std::string header = "P6\n" + std::to_string(w) + " " + std::to_string(h) + "\n255\n";
+            put(header.data(), header.size());
+            rgb.resize(3 * size_t(w));
+            return true;
+        }
+
+        virtual void writeRow(const std::uint8_t *row){
+            for(int x = 0; x < width; ++x)
+                for(int c = 0; c < 3; ++c)
+                    rgb[3*x + c] = row[4*x + c];
+            put(&rgb[0], rgb.size());
+        }
+
+        virtual bool close(std::string& error){
+            return closeFile(error);
+        }
+
+    private:
+        int width;
+        std::vector<std::uint8_t> rgb;
+};
+
+// The RGBA bytes as they are, without any header; the same data that is
+// streamed to stdout with the filename "-".
+class RawWriter : public ImageWriter{
+    public:
+        virtual bool open(const std::string& filename, int w, int, std::string& error){
+            width = w;
+            return openFile(filename, error);
+        }
+
+        virtual void writeRow(const std::uint8_t *row){
+            put(row, 4 * size_t(width));
+        }
+
+        virtual bool close(std::string& error){
+            return closeFile(error);
+        }
+
+    private:
+        int width;
+};
+
+// Returns the writer for format (png, fastpng, qoi, ppm or raw) or nullptr.
+inline ImageWriter* createImageWriter(const std::string& format){
+    if(format == "png")
+        return new PngWriter(false);
+    if(format == "fastpng")
+        return new PngWriter(true);
+    if(format == "qoi")
+        return new QoiWriter();
+    if(format == "ppm")
+        return new PpmWriter();
+    if(format == "raw")
+        return new RawWriter();
+    return nullptr;
+}
+
+// Format for the extension of filename; PNG for unknown extensions.
+inline std::string imageFormat(const std::string& filename){
+    size_t dot = filename.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : filename.substr(dot);
+    if(extension == ".qoi")
+        return "qoi";
+    if(extension == ".ppm")
+        return "ppm";
+    if(extension == ".rgba" || extension == ".raw")
+        return "raw";
+    return "png";
+}
+
+#endif
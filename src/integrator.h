@@ -0,0 +1,138 @@
+#ifndef INTEGRATORH
+#define INTEGRATORH
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "ray.h"
+#include "material.h"
+
+// Paths are terminated after this many bounces.
+const int maxDepth = 150;
+
+// Radiance of rays leaving the scene: a gradient from white at the horizon to
+// light blue at the zenith.
+inline vec3 skyColor(const Ray& r){
+    vec3 dir = unitVector(r.getDirection());
+    float t = 0.5*(dir.y() + 1.0);
+    return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
+}
+
+// Per-path data for the denoiser and the AOVs, updated at every hit of a path.
+// Albedo, normal and depth are taken at the first non-specular hit: behind
+// mirrors and glass the albedo is weighted by their attenuation and the depth
+// is the length of the whole path. Rays leaving the scene see the sky as
+// albedo, a zero normal and an infinite depth. Material and primitive id
+// belong to the first hit, bounces counts all hits of the path.
+struct PathFeatures{
+    vec3 albedo;
+    vec3 normal;
+    float depth;
+    int materialId;
+    int primitiveId;
+    int bounces;
+
+    bool pending;
+    vec3 weight;
+    float distance;
+
+    void start(){
+        materialId = -1;
+        primitiveId = -1;
+        bounces = 0;
+        pending = true;
+        weight = vec3(1, 1, 1);
+        distance = 0;
+    }
+
+    void hitSurface(const Ray& r, const hitRecord& hitRec, int pathDepth, bool scattered, const vec3& attenuation){
+        if(pathDepth == 0){
+            materialId = hitRec.mat->getType();
+            primitiveId = hitRec.primitiveId;
+        }
+        bounces = pathDepth + 1;
+        if(!pending)
+            return;
+        float segment = hitRec.t * r.getDirection().length();
+        if(scattered && hitRec.mat->isSpecular()){
+            weight *= attenuation;
+            distance += segment;
+        }else{
+            albedo = weight * hitRec.mat->getAlbedo();
+            normal = hitRec.normal;
+            depth = distance + segment;
+            pending = false;
+        }
+    }
+
+    void miss(const Ray& r){
+        if(!pending)
+            return;
+        albedo = weight * skyColor(r);
+        normal = vec3(0, 0, 0);
+        depth = MAXFLOAT;
+        pending = false;
+    }
+};
+
+// Features of all samples of a pixel: albedo, normal and bounces are averaged,
+// the depth is the nearest hit and the ids are those of the first sample.
+// Samples may be added in any order, the wavefront integrator adds them as
+// their paths end, so add is told the index of the sample.
+struct PixelFeatures{
+    vec3 albedoSum;
+    vec3 normalSum;
+    float minDepth;
+    int materialId;
+    int primitiveId;
+    int bounceSum;
+    int samples;
+
+    PixelFeatures() : albedoSum(0, 0, 0), normalSum(0, 0, 0), minDepth(MAXFLOAT), materialId(-1), primitiveId(-1), bounceSum(0), samples(0){}
+
+    void add(const PathFeatures& path, int sample){
+        if(sample == 0){
+            materialId = path.materialId;
+            primitiveId = path.primitiveId;
+        }
+        albedoSum += path.albedo;
+        normalSum += path.normal;
+        minDepth = std::min(minDepth, path.depth);
+        bounceSum += path.bounces;
+        ++samples;
+    }
+};
+
+// The pixels to render, in render coordinates with the first row at the
+// bottom; x1 and y1 are exclusive.
+struct PixelRegion{
+    PixelRegion(int width, int height) : x0(0), y0(0), x1(width), y1(height){}
+    PixelRegion(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1){}
+
+    bool contains(int x, int y) const{
+        return x >= x0 && x < x1 && y >= y0 && y < y1;
+    }
+
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// Gamma-corrects the averaged radiance of a pixel into 8 bit RGBA.
+inline void toRgba(vec3 col, std::uint8_t *rgba){
+    col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
+    rgba[0] = int(255.99 * col[0]);
+    rgba[1] = int(255.99 * col[1]);
+    rgba[2] = int(255.99 * col[2]);
+    rgba[3] = 255;
+}
+
+// Stores the radiance of pixel (x, y) in the RGBA image, whose first row is
+// the top of the frame. Without an image (streamed frames) nothing is stored.
+inline void storePixel(std::vector<std::uint8_t> *img, int width, int height, int x, int y, vec3 col){
+    if(img)
+        toRgba(col, &(*img)[4 * width * (height - y - 1) + 4 * x]);
+}
+
+#endif
@@ -8,18 +8,45 @@
 #include "camera.h"
 #include "math_util.h"
 #include "material.h"
+#include "animation.h"
+#include "sampler.h"
+#include "integrator.h"
+#include "wavefront.h"
+#include "framebuffer.h"
+#include "denoise.h"
+#include "stream.h"
+#include "preview.h"
+#include "shared_framebuffer.h"
+#include "camera_control.h"
+#include "server.h"
+#include "renderer.h"
+#include "stats.h"
+#include "heatmap.h"
 #include "lodepng/lodepng.h"
+#ifndef HEADLESS
 #include <SDL/SDL.h>
 #include <GL/gl.h>
+#endif
 #include <thread>
 #include <algorithm>
+#include <numeric>
+#include <cstdio>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <fstream>
+#include <sys/stat.h>
 
 namespace po = boost::program_options;
 
-vec3 color(const Ray& r, Surface *scene, int depth);
-Surface* randomScene(int varA, int varB);
-void render(std::vector<std::uint8_t> *img, int width, int height, int numRaysPixel, Surface* scene, vec3 lookFrom, vec3 lookAt, float focalDistance, float aperture, float vfov, bool shuffle);
-int preview(std::vector<std::uint8_t> *img, int width, int height, int pwidth, int pheight);
+void render(std::vector<std::uint8_t> *img, Framebuffer *fb, int width, int height, int numRaysPixel, Surface* scene, vec3 lookFrom, vec3 lookAt, float focalDistance, float aperture, float vfov, bool shuffle, const Sampler& sampler, bool wavefront, bool reorder, WavefrontStats *stats, FrameStream *stream, PreviewBuffer *preview, const PixelRegion& region);
+void renderInteractive(std::vector<std::uint8_t> *img, int width, int height, int numRaysPixel, Surface* scene, CameraControl& control, const Sampler& sampler, PreviewBuffer *preview, ImageWriter *writer, const std::string& filename);
+#ifndef HEADLESS
+int preview(PreviewBuffer *buffer, int pwidth, int pheight, CameraControl *control);
+#endif
+std::string frameFilename(const std::string& pattern, int frame, int numFrames);
+int serve(const std::string& socketPath, const std::string& outputDir, int sceneCacheSize, const RenderJob& defaults);
 
 int main(int argc, const char *argv[])
 {
@@ -35,12 +62,38 @@ int main(int argc, const char *argv[])
     int pwidth;
     int pheight;
     bool shuffle;
+    int numFrames;
+    std::string animationFile;
+    std::string samplerName;
+    std::string integratorName;
+    bool reorder;
+    bool rayStats;
+    bool renderStats;
+    bool perfCounters;
+    std::string statsJsonFile;
+    std::string heatmapFile;
+    std::string heatmapMetric;
+    Denoiser denoiser;
+    bool denoise;
+    std::string aovFile;
+    std::string hdrFile;
+    std::string format;
+    bool streamFrames;
+    bool noPreview;
+    std::string sharedName;
+    bool interactive;
+    std::string serverSocket;
+    std::string outputDir;
+    int sceneCacheSize;
+    int firstSample;
+    std::string regionText;
     std::string filename;
 
     po::options_description desc("A very simple ray tracer (╯°□°)╯︵ ┻━┻\n\nSupported parameters");
     desc.add_options()
     ("help", "print available parameters")
     ("filename", po::value<std::string>(&filename), "filename to store the rendered scene as png-file")
+    ("format", po::value<std::string>(&format), "image format: png, fastpng, qoi, ppm or raw (RGBA bytes); by default chosen by the extension of the filename")
     ("width", po::value<int>(&width)->default_value(1280), "width for the rendered scene")
     ("height", po::value<int>(&height)->default_value(720), "height for the rendered scene")
     ("num-rays", po::value<int>(&numRaysPixel)->default_value(100), "number of rays per pixel ('Anti-Aliasing')")
@@ -48,11 +101,35 @@ int main(int argc, const char *argv[])
     ("aperture", po::value<float>(&aperture)->default_value(0.01), "aperture of the camera")
     ("focal-distance", po::value<float>(&focalDistance)->default_value(10), "focal distance of the camera")
     ("seed", po::value<int>(&seed)->default_value(42), "random seed for the scene")
+    ("first-sample", po::value<int>(&firstSample)->default_value(0), "index of the first sample of every pixel, to split the samples of a frame over several runs")
+    ("region", po::value<std::string>(&regionText), "render only the pixels of the rectangle x,y,width,height, counted from the top left corner, the others are black")
     ("var-a", po::value<int>(&varA)->default_value(11), "controls the number of random spheres")
     ("var-b", po::value<int>(&varB)->default_value(11), "controls the number of random spheres")
     ("pwidth", po::value<int>(&pwidth)->default_value(1280), "width for the preview frame")
     ("pheight", po::value<int>(&pheight)->default_value(720), "height for the preview frame")
-    ("shuffle", po::bool_switch(&shuffle)->default_value(false), "randomizes the order of computation of the pixels");
+    ("no-preview", po::bool_switch(&noPreview)->default_value(false), "do not open the preview window, for servers and batch jobs without a display")
+    ("shared-framebuffer", po::value<std::string>(&sharedName), "publish the image and a table of tile versions while rendering for external viewers, in POSIX shared memory (/name) or a memory-mapped file (any other path)")
+    ("interactive", po::bool_switch(&interactive)->default_value(false), "move the camera in the preview window and render progressively until it stands still, Return saves the image")
+    ("server", po::value<std::string>(&serverSocket), "run as render server, reading JSON jobs from the Unix domain socket at this path or from stdin with -")
+    ("output-dir", po::value<std::string>(&outputDir)->default_value("."), "directory the images of the server's jobs are written to; their filenames are relative to it")
+    ("scene-cache", po::value<int>(&sceneCacheSize)->default_value(8), "number of scenes the server keeps for later jobs")
+    ("shuffle", po::bool_switch(&shuffle)->default_value(false), "randomizes the order of computation of the pixels")
+    ("frames", po::value<int>(&numFrames)->default_value(1), "number of frames to render; without --animation the camera orbits the scene once")
+    ("animation", po::value<std::string>(&animationFile), "file with camera and sphere keyframes")
+    ("sampler", po::value<std::string>(&samplerName)->default_value("random"), "sample generator: random, sobol, halton or bluenoise")
+    ("integrator", po::value<std::string>(&integratorName)->default_value("recursive"), "path tracer: recursive (one path at a time) or wavefront (batches of paths with per-material shading queues)")
+    ("reorder", po::bool_switch(&reorder)->default_value(false), "sort the scattered rays of every bounce by origin and direction before tracing them (wavefront integrator)")
+    ("ray-stats", po::bool_switch(&rayStats)->default_value(false), "print per-bounce ray counts, hit coherence and throughput (wavefront integrator)")
+    ("stats", po::bool_switch(&renderStats)->default_value(false), "print the time of every phase, ray and intersection counts, scatter calls per material, path lengths and rays per second of every thread")
+    ("stats-json", po::value<std::string>(&statsJsonFile), "also write the statistics of --stats as JSON file")
+    ("perf-counters", po::bool_switch(&perfCounters)->default_value(false), "add cycles, instructions, cache and branch misses of every phase and thread to the statistics, read with Linux perf_event_open")
+    ("heatmap", po::value<std::string>(&heatmapFile), "also write the render cost of every pixel as false-color image, and the raw time and ray count per pixel as <name>_data.exr")
+    ("heatmap-metric", po::value<std::string>(&heatmapMetric)->default_value("time"), "cost shown by the heatmap: time or rays")
+    ("denoise", po::bool_switch(&denoise)->default_value(false), "filter the rendered image guided by albedo, normal and depth of the first hits")
+    ("denoise-iterations", po::value<int>(&denoiser.iterations)->default_value(5), "number of a-trous wavelet levels of the denoiser, 1 to 10")
+    ("aov", po::value<std::string>(&aovFile), "also write linear radiance, depth, normal, albedo, material and primitive id, bounce and sample count as multi-channel EXR file")
+    ("hdr", po::value<std::string>(&hdrFile), "also stream the linear radiance as float image while rendering, .pfm or .exr file")
+    ("stream", po::bool_switch(&streamFrames)->default_value(false), "write the image band by band while rendering and keep only the bands in flight in memory, for very large frames (no preview, --denoise or --aov)");
 
     po::positional_options_description p;
     p.add("filename", -1);
@@ -65,155 +142,618 @@ int main(int argc, const char *argv[])
         std::cout << desc << std::endl;
         return 1;
     }
+    else if(vm.count("server"))
+    {
+        RenderJob defaults;
+        defaults.priority = 0;
+        defaults.format = format;
+        defaults.width = width;
+        defaults.height = height;
+        defaults.numRaysPixel = numRaysPixel;
+        defaults.seed = seed;
+        defaults.varA = varA;
+        defaults.varB = varB;
+        defaults.vfov = vfov;
+        defaults.aperture = aperture;
+        defaults.focalDistance = focalDistance;
+        defaults.lookFrom = vec3(13,2,3);
+        defaults.lookAt = vec3(0,0,0);
+        defaults.sampler = samplerName;
+        defaults.integrator = integratorName;
+        defaults.shuffle = shuffle;
+        if(sceneCacheSize < 1){
+            std::cerr << "--scene-cache has to be at least 1" << std::endl;
+            return 1;
+        }
+        return serve(serverSocket, outputDir, sceneCacheSize, defaults);
+    }
     else if(!vm.count("filename"))
     {
         std::cout << "Please provide a filename to store the rendered scene." << std::endl << std::endl << desc << std::endl;
         return 1;
     }
 
+    std::unique_ptr<Sampler> sampler(createSampler(samplerName, seed));
+    if(!sampler){
+        std::cerr << "Unknown sampler '" << samplerName << "'" << std::endl << std::endl << desc << std::endl;
+        return 1;
+    }
+
+    if(integratorName != "recursive" && integratorName != "wavefront"){
+        std::cerr << "Unknown integrator '" << integratorName << "'" << std::endl << std::endl << desc << std::endl;
+        return 1;
+    }
+    bool wavefront = integratorName == "wavefront";
+    if(numFrames < 1){
+        std::cerr << "--frames has to be at least 1" << std::endl;
+        return 1;
+    }
+    if((reorder || rayStats) && !wavefront){
+        std::cerr << "--reorder and --ray-stats require --integrator wavefront" << std::endl;
+        return 1;
+    }
+    WavefrontStats wavefrontStats;
+    sampler->firstSample = firstSample;
+
+    PixelRegion region(width, height);
+    if(vm.count("region")){
+        int x, y, w, h;
+        char end;
+        if(std::sscanf(regionText.c_str(), "%d,%d,%d,%d%c", &x, &y, &w, &h, &end) != 4 || w <= 0 || h <= 0){
+            std::cerr << "--region needs x,y,width,height" << std::endl;
+            return 1;
+        }
+        // the region is given from the top, the renderer counts rows from the bottom
+        region = PixelRegion(std::max(0, x), std::max(0, height - y - h), std::min(width, x + w), std::min(height, height - y));
+    }
+
+    std::unique_ptr<HdrWriter> hdr;
+    if(vm.count("hdr")){
+        hdr.reset(createHdrWriter(hdrFile));
+        if(!hdr){
+            std::cerr << "Unknown HDR format of '" << hdrFile << "', use .pfm or .exr" << std::endl;
+            return 1;
+        }
+    }
+
+    // "-" streams raw RGBA frames to stdout, so status messages go to stderr
+    bool toStdout = filename == "-";
+    std::unique_ptr<ImageWriter> writer(createImageWriter(vm.count("format") ? format : imageFormat(filename)));
+    if(!writer){
+        std::cerr << "Unknown image format '" << format << "'" << std::endl << std::endl << desc << std::endl;
+        return 1;
+    }
+    std::ostream& log = toStdout ? std::cerr : std::cout;
+    if(streamFrames && (toStdout || denoise || vm.count("aov") || vm.count("shared-framebuffer") || vm.count("heatmap"))){
+        std::cerr << "--stream needs a filename and the whole frame is needed by --denoise, --aov, --shared-framebuffer and --heatmap" << std::endl;
+        return 1;
+    }
+    if(denoiser.iterations < 1 || denoiser.iterations > Denoiser::maxIterations){
+        std::cerr << "--denoise-iterations has to be between 1 and " << Denoiser::maxIterations << std::endl;
+        return 1;
+    }
+    if(heatmapMetric != "time" && heatmapMetric != "rays"){
+        std::cerr << "Unknown heatmap metric '" << heatmapMetric << "', use time or rays" << std::endl;
+        return 1;
+    }
+
+    if(perfCounters)
+        RenderStats::instance().enablePerfCounters();
+
     srand48(seed);
-    Surface* scene = randomScene(varA, varB);
+    SurfaceList* scene;
+    {
+        ScopedPhase phase("scene");
+        PerfScope perf(PHASE_SCENE);
+        scene = randomScene(varA, varB);
+    }
     vec3 lookFrom = vec3(13,2,3);
     vec3 lookAt = vec3(0,0,0);
 
+    Animation animation;
+    if(vm.count("animation")){
+        std::string error;
+        if(!animation.load(animationFile, error)){
+            std::cerr << "animation error: " << error << std::endl;
+            return 1;
+        }
+    }
+    if(numFrames > 1 && !animation.hasCamera())
+        animation.orbit(lookFrom, lookAt, numFrames);
+
+#ifdef HEADLESS
+    // built without SDL and OpenGL
+    noPreview = true;
+#endif
+    if(interactive && (noPreview || streamFrames || toStdout)){
+        std::cerr << "--interactive needs the preview window and a filename to save the image to" << std::endl;
+        return 1;
+    }
+    if(interactive && (wavefront || reorder)){
+        std::cerr << "--interactive renders with the recursive integrator, without --integrator wavefront and --reorder" << std::endl;
+        return 1;
+    }
+
+    // streamed frames are never held as a whole, so there is no preview
     std::vector<std::uint8_t> img;
-    img.resize(width*height*4);
+    Framebuffer fb;
+    std::unique_ptr<PreviewBuffer> previewBuffer;
+    std::unique_ptr<SharedFramebuffer> shared;
+    std::unique_ptr<CameraControl> control;
+    if(interactive){
+        CameraView view = {lookFrom, lookAt, vfov, aperture, focalDistance};
+        control.reset(new CameraControl(view));
+    }
+    std::thread t1;
+    if(streamFrames){
+        fb.resize(width, height, false, FrameStream::bandRows * FrameStream::bandsInFlight);
+    }else{
+        img.resize(width*height*4);
+        fb.resize(width, height, denoise || vm.count("aov"));
+        if(vm.count("heatmap"))
+            fb.enableCost();
+        if(!noPreview || vm.count("shared-framebuffer"))
+            previewBuffer.reset(new PreviewBuffer(&img, width, height, !noPreview));
+        if(vm.count("shared-framebuffer")){
+            std::string error;
+            shared.reset(new SharedFramebuffer);
+            if(!shared->create(sharedName, &img, width, height, error)){
+                std::cerr << error << std::endl;
+                return 1;
+            }
+            previewBuffer->attach(shared.get());
+        }
+#ifndef HEADLESS
+        if(!noPreview)
+            t1 = std::thread(preview, previewBuffer.get(), pwidth, pheight, control.get());
+#endif
+    }
 
-    std::thread t1(preview, &img, width, height, pwidth, pheight);
+    if(interactive){
+        ScopedPhase phase("render");
+        renderInteractive(&img, width, height, numRaysPixel, scene, *control, *sampler, previewBuffer.get(), writer.get(), filename);
+    }
 
-    render(&img, width, height, numRaysPixel, scene, lookFrom, lookAt, focalDistance, aperture, vfov, shuffle);
+    for(int frame = 0; frame < numFrames && !interactive; ++frame){
+        animation.apply(scene, frame);
+        animation.cameraAt(frame, lookFrom, lookAt);
+
+        std::string frameName = frameFilename(filename, frame, numFrames);
+        std::string error;
+        bool streamImage = streamFrames && writer->open(frameName, width, height, error);
+        if(streamFrames && !streamImage)
+            log << error << std::endl;
+        std::string hdrName = frameFilename(hdrFile, frame, numFrames);
+        bool streamHdr = hdr && hdr->open(hdrName, width, height);
+        if(hdr && !streamHdr)
+            log << "unable to write HDR image to " << hdrName << std::endl;
+
+        std::unique_ptr<FrameStream> stream;
+        if(streamImage || streamHdr)
+            stream.reset(new FrameStream(&fb, streamImage ? writer.get() : nullptr, streamHdr ? hdr.get() : nullptr));
+        if(previewBuffer)
+            previewBuffer->startFrame();
+        if(shared)
+            shared->startFrame(frame);
+        {
+            ScopedPhase phase("render");
+            render(streamFrames ? nullptr : &img, &fb, width, height, numRaysPixel, scene, lookFrom, lookAt, focalDistance, aperture, vfov, shuffle, *sampler, wavefront, reorder, rayStats ? &wavefrontStats : nullptr, stream.get(), previewBuffer.get(), region);
+        }
+        {
+            // the streamed bands are encoded while rendering, this is the rest
+            ScopedPhase phase("encode");
+            PerfScope perf(PHASE_ENCODE);
+            if(stream)
+                stream->finish();
+            if(streamHdr && !hdr->close())
+                log << "unable to write HDR image to " << hdrName << std::endl;
+            if(streamImage){
+                if(!writer->close(error))
+                    log << error << std::endl;
+                else if(numFrames > 1)
+                    log << "Frame " << frame + 1 << "/" << numFrames << " saved as " << frameName << std::endl;
+            }
+        }
+        if(vm.count("aov")){
+            ScopedPhase phase("aov");
+            std::string aovName = frameFilename(aovFile, frame, numFrames);
+            if(!fb.writeAovs(aovName))
+                log << "unable to write AOVs to " << aovName << std::endl;
+        }
+        if(vm.count("heatmap")){
+            std::string heatmapName = frameFilename(heatmapFile, frame, numFrames);
+            float scale;
+            if(!Heatmap::write(heatmapName, fb, heatmapMetric == "rays", scale, error))
+                log << error << std::endl;
+            else if(!Heatmap::writeData(Heatmap::dataFilename(heatmapName), fb))
+                log << "unable to write the heatmap data to " << Heatmap::dataFilename(heatmapName) << std::endl;
+            else
+                log << "Heatmap saved as " << heatmapName << ", brightest from " << scale << (heatmapMetric == "rays" ? " rays" : " seconds") << " per pixel" << std::endl;
+        }
+        if(denoise){
+            ScopedPhase phase("denoise");
+            denoiser.apply(fb);
+            fb.toImage(&img);
+            if(previewBuffer)
+                previewBuffer->publish(0, 0, width, height);
+        }
+        if(shared)
+            shared->finishFrame();
+
+        if(streamFrames)
+            continue;
+
+        ScopedPhase phase("encode");
+        PerfScope perf(PHASE_ENCODE);
+        if(toStdout){
+            std::fwrite(&img[0], 1, img.size(), stdout);
+            std::fflush(stdout);
+        }else if(!writer->write(frameName, img, width, height, error)){
+            log << error << std::endl;
+        }else if(numFrames > 1){
+            log << "Frame " << frame + 1 << "/" << numFrames << " saved as " << frameName << std::endl;
+        }
+    }
 
-    unsigned error = lodepng::encode(filename, img, width, height);
-    if(error)
-        std::cout << "encoder error " << error << ": "<< lodepng_error_text(error) << std::endl;
+#ifndef HEADLESS
+    if(t1.joinable()){
+        SDL_Event sdlevent;
+        sdlevent.type = SDL_QUIT;
+        SDL_PushEvent(&sdlevent);
 
-    SDL_Event sdlevent;
-    sdlevent.type = SDL_QUIT;
-    SDL_PushEvent(&sdlevent);
+        t1.join();
+    }
+#endif
+
+    if(rayStats)
+        wavefrontStats.print(log);
+    if(renderStats || (perfCounters && !vm.count("stats-json")))
+        RenderStats::instance().print(log);
+    if(vm.count("stats-json")){
+        std::ofstream json(statsJsonFile);
+        RenderStats::instance().printJson(json);
+        if(!json)
+            log << "unable to write statistics to " << statsJsonFile << std::endl;
+    }
 
-    t1.join();
+    if(toStdout)
+        log << "Done. Streamed " << numFrames << " frame(s) of " << width << "x" << height << " RGBA to stdout" << std::endl;
+    else if(numFrames > 1)
+        log << "Done. Rendered " << numFrames << " frames" << std::endl;
+    else
+        log << "Done. Rendered scene saved as " << filename << std::endl;
+}
 
-    std::cout << "Done. Rendere scene saved as " << filename << std::endl;
+// Numbers the output file of an animation: a pattern with one "%d" or "%0Nd",
+// such as "frame_%04d.png", gets the frame number there, otherwise "_%04d" is
+// inserted before the extension. Any other '%' is kept as it is. Single
+// frames keep the plain filename.
+std::string frameFilename(const std::string& pattern, int frame, int numFrames)
+{
+    if(numFrames <= 1)
+        return pattern;
+
+    size_t start = 0;
+    size_t end = 0;
+    int digits = 0;
+    for(size_t p = pattern.find('%'); p != std::string::npos; p = pattern.find('%', p + 1)){
+        size_t q = p + 1;
+        int width = 0;
+        if(q < pattern.size() && pattern[q] == '0')
+            while(++q < pattern.size() && pattern[q] >= '0' && pattern[q] <= '9' && width < 10)
+                width = 10 * width + (pattern[q] - '0');
+        if(q < pattern.size() && pattern[q] == 'd' && (q == p + 1 || width > 0)){
+            start = p;
+            end = q + 1;
+            digits = width;
+            break;
+        }
+    }
+    if(end == 0){
+        size_t dot = pattern.find_last_of('.');
+        size_t slash = pattern.find_last_of('/');
+        if(dot == std::string::npos || (slash != std::string::npos && dot < slash))
+            dot = pattern.size();
+        start = end = dot;
+        digits = 4;
+    }
+
+    std::string number = std::to_string(frame);
+    if(int(number.size()) < digits)
+        number.insert(0, digits - number.size(), '0');
+    std::string name = pattern.substr(0, start);
+    if(end == start)
+        name += "_";
+    return name + number + pattern.substr(end);
 }
 
-void render(std::vector<std::uint8_t> *img, int width, int height, int numRaysPixel, Surface* scene, vec3 lookFrom, vec3 lookAt, float focalDistance, float aperture, float vfov, bool shuffle)
+void render(std::vector<std::uint8_t> *img, Framebuffer *fb, int width, int height, int numRaysPixel, Surface* scene, vec3 lookFrom, vec3 lookAt, float focalDistance, float aperture, float vfov, bool shuffle, const Sampler& samplerPrototype, bool wavefront, bool reorder, WavefrontStats *stats, FrameStream *stream, PreviewBuffer *preview, const PixelRegion& region)
 {
     Camera cam(lookFrom, lookAt, vec3(0,1,0), vfov, float(width)/float(height), aperture, focalDistance);
-    std::vector<int> indices;
-    if(shuffle){
-        indices.resize(width*height);
-        for(int i = 0; i < width*height; ++i)
-            indices[i] = i;
+    if(wavefront){
+        renderWavefront(img, fb, width, height, numRaysPixel, scene, cam, shuffle, samplerPrototype, reorder, stats, stream, preview, region);
+        return;
+    }
 
-        std::random_shuffle(indices.begin(), indices.end());
+    // a streamed frame is rendered in bands of rows from the top, every band
+    // is written as soon as it is complete
+    int bandHeight = stream ? FrameStream::bandRows : height;
+    int numBands = (height + bandHeight - 1) / bandHeight;
+    std::vector<int> indices(width*bandHeight);
+    for(int i = 0; i < width*bandHeight; ++i)
+        indices[i] = i;
 
-    }
+    #pragma omp parallel
+    {
+        std::unique_ptr<Sampler> sampler(samplerPrototype.clone());
+        PerfScope perf(PHASE_RENDER);
 
-    #pragma omp parallel for
-    for(int i = 0; i < height*width; ++i){
-        int j = i;
+        for(int band = numBands - 1; band >= 0; --band){
+            int y0 = band*bandHeight;
+            int y1 = std::min(height, y0 + bandHeight);
+            int bandSize = (y1 - y0)*width;
 
-        if(shuffle){
-            j = indices[i];
-        }
+            #pragma omp single
+            {
+                if(stream)
+                    stream->beginBand(y0);
+                if(shuffle){
+                    std::iota(indices.begin(), indices.begin() + bandSize, 0);
+                    std::random_shuffle(indices.begin(), indices.begin() + bandSize);
+                }
+            }
 
-        int x = j % width;
-        int y = j / width;
+            #pragma omp for
+            for(int i = 0; i < bandSize; ++i){
+                int j = y0*width + indices[i];
+                int x = j % width;
+                int y = j / width;
+                if(!region.contains(x, y)){
+                    fb->radiance[fb->index(x, y)] = vec3(0, 0, 0);
+                    if(fb->hasFeatures())
+                        fb->clearFeatures(x, y);
+                    if(fb->hasCost())
+                        fb->setCost(x, y, 0, 0);
+                    storePixel(img, width, height, x, y, vec3(0, 0, 0));
+                    if(preview)
+                        preview->finishPixel(y);
+                    continue;
+                }
 
-        vec3 col(0, 0, 0);
-        for (int i = 0; i < numRaysPixel; ++i) {
-            float u = float(x + drand48()) / float(width);
-            float v = float(y + drand48()) / float(height);
-            Ray r = cam.getRay(u, v);
-            col += color(r, scene, 0);
+                vec3 col = renderPixel(x, y, width, height, numRaysPixel, scene, cam, *sampler, *fb);
+                storePixel(img, width, height, x, y, col);
+                if(preview)
+                    preview->finishPixel(y);
+            }
+
+            #pragma omp single
+            if(stream)
+                stream->endBand(y0);
         }
-        col /= float(numRaysPixel);
-        col = vec3(sqrt(col[0]), sqrt(col[1]), sqrt(col[2]));
-        (*img)[4 * width * (height - y - 1) + 4 * x + 0] = int(255.99 * col[0]);
-        (*img)[4 * width * (height - y - 1) + 4 * x + 1] = int(255.99 * col[1]);
-        (*img)[4 * width * (height - y - 1) + 4 * x + 2] = int(255.99 * col[2]);
-        (*img)[4 * width * (height - y - 1) + 4 * x + 3] = 255;
     }
 }
 
-vec3 color(const Ray& r, Surface *scene, int depth)
+// Runs the render server until it is shut down. The scenes of the jobs are
+// built once per seed, var-a and var-b and kept for the following jobs, up to
+// sceneCacheSize scenes; the least recently used one is freed first. The
+// images are written below outputDir.
+int serve(const std::string& socketPath, const std::string& outputDir, int sceneCacheSize, const RenderJob& defaults)
 {
-    hitRecord hitRec;
-    if(scene->hit(r, 0.001, MAXFLOAT, hitRec))
-    {
-        Ray scattered;
-        vec3 attenuation;
-        if(depth < 150 && hitRec.mat->scatter(r, hitRec, attenuation, scattered))
-        {
-            return attenuation*color(scattered, scene, depth+1);
+    struct stat status;
+    if(stat(outputDir.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)){
+        std::cerr << "output directory " << outputDir << " does not exist" << std::endl;
+        return 1;
+    }
+    // the most recently used scene first; the jobs run one after the other
+    std::list<std::pair<std::string, SurfaceList*> > scenes;
+    RenderServer server(defaults, [&scenes, &outputDir, sceneCacheSize](const RenderJob& job, ServerMessage& result, std::string& error){
+        std::unique_ptr<Sampler> sampler(createSampler(job.sampler, job.seed));
+        if(!sampler){
+            error = "unknown sampler '" + job.sampler + "'";
+            return false;
         }
-        else
-        {
-            return vec3(0,0,0);
+        if(job.integrator != "recursive" && job.integrator != "wavefront"){
+            error = "unknown integrator '" + job.integrator + "'";
+            return false;
         }
+        std::unique_ptr<ImageWriter> writer(createImageWriter(job.format.empty() ? imageFormat(job.filename) : job.format));
+        if(!writer){
+            error = "unknown image format '" + job.format + "'";
+            return false;
+        }
+
+        std::ostringstream key;
+        key << job.seed << "/" << job.varA << "/" << job.varB;
+        std::list<std::pair<std::string, SurfaceList*> >::iterator cached = scenes.begin();
+        while(cached != scenes.end() && cached->first != key.str())
+            ++cached;
+        result.put("sceneCached", cached != scenes.end());
+        if(cached != scenes.end()){
+            scenes.splice(scenes.begin(), scenes, cached);
+        }else{
+            srand48(job.seed);
+            scenes.push_front(std::make_pair(key.str(), randomScene(job.varA, job.varB)));
+            if(int(scenes.size()) > sceneCacheSize){
+                deleteScene(scenes.back().second);
+                scenes.pop_back();
+            }
+        }
+        SurfaceList *scene = scenes.front().second;
+
+        std::vector<std::uint8_t> img(size_t(job.width)*job.height*4);
+        Framebuffer fb;
+        fb.resize(job.width, job.height, false);
+        render(&img, &fb, job.width, job.height, job.numRaysPixel, scene, job.lookFrom, job.lookAt, job.focalDistance, job.aperture, job.vfov, job.shuffle, *sampler, job.integrator == "wavefront", false, nullptr, nullptr, nullptr, PixelRegion(job.width, job.height));
+        // parseJob only accepts relative filenames without ".."
+        std::string path = outputDir + "/" + job.filename;
+        result.put("filename", job.filename);
+        if(!writer->write(path, img, job.width, job.height, error))
+            return false;
+        // the image stays in the output directory, the client is told where
+        struct stat status;
+        result.put("path", path);
+        if(stat(path.c_str(), &status) == 0)
+            result.put("bytes", long(status.st_size));
+        return true;
+    });
+
+    if(socketPath == "-"){
+        server.serveStdin();
+    }else{
+        std::string error;
+        if(!server.listen(socketPath, error)){
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        std::cerr << "Listening on " << socketPath << std::endl;
     }
-    else
-    {
-        vec3 dir = unitVector(r.getDirection());
-        float t = 0.5*(dir.y() + 1.0);
-        return (1.0-t)*vec3(1.0, 1.0, 1.0) + t*vec3(0.5, 0.7, 1.0);
-    }
+    server.run();
+    for(std::list<std::pair<std::string, SurfaceList*> >::iterator it = scenes.begin(); it != scenes.end(); ++it)
+        deleteScene(it->second);
+    return 0;
 }
 
-Surface* randomScene(int varA, int varB)
+// Renders a progressive pass of the interactive mode into img: with a scale
+// above one a coarse pass with one sample per block of scale x scale pixels,
+// otherwise the sample with the given index of every pixel, accumulated in
+// accum. Every tile first checks whether the view is still current, so a pass
+// is given up within a tile once the camera moves. Returns whether the pass
+// is complete.
+bool renderPass(std::vector<std::uint8_t> *img, std::vector<vec3>& accum, int width, int height, int scale, int sampleIndex, Surface* scene, const Camera& cam, const CameraControl& control, unsigned version, const Sampler& samplerPrototype, PreviewBuffer *preview)
 {
-    int n = 500;
-    Surface **list = new Surface*[n+1];
-    list[0] = new Sphere(vec3(0,-1000,0), 1000, new Lambertian(vec3(0.5,0.5,0.5)));
-    int i = 1;
-    for(int a = -varA; a < varA; ++a)
+    const int tilePixels = 16*scale;
+    int tilesX = (width + tilePixels - 1) / tilePixels;
+    int tilesY = (height + tilePixels - 1) / tilePixels;
+    std::atomic<bool> cancelled(false);
+
+    #pragma omp parallel
     {
-        for(int b = -varB; b < varB; ++b)
-        {
-            float randMat = drand48();
-            vec3 center(a+0.9*drand48(), 0.2, b+drand48());
-            if((center-vec3(4,0.2,0)).length() > 0.9)
-            {
-                if(randMat < 0.8)
-                {
-                    list[i++] = new Sphere(center, 0.2, new Lambertian(vec3(drand48()*drand48(), drand48()*drand48(), drand48()*drand48())));
-                }
-                else if(randMat < 0.95)
-                {
-                    list[i++] = new Sphere(center, 0.2,
-                                           new Metal(vec3(0.5*(1+drand48()), 0.5*(1+drand48()), 0.5*(1+drand48())), 0.5*drand48()));
-                }
-                else
-                {
-                    list[i++] = new Sphere(center, 0.2, new Dielectric(1.5+(drand48()*2 - 1.0)));
+        std::unique_ptr<Sampler> sampler(samplerPrototype.clone());
+        Camera camera = cam;
+
+        #pragma omp for schedule(dynamic)
+        for(int t = 0; t < tilesX*tilesY; ++t){
+            if(cancelled || control.getVersion() != version){
+                cancelled = true;
+                continue;
+            }
+            int x0 = (t % tilesX) * tilePixels;
+            int y0 = (t / tilesX) * tilePixels;
+            int x1 = std::min(width, x0 + tilePixels);
+            int y1 = std::min(height, y0 + tilePixels);
+            for(int y = y0; y < y1; y += scale){
+                for(int x = x0; x < x1; x += scale){
+                    int sx = std::min(x1 - 1, x + scale/2);
+                    int sy = std::min(y1 - 1, y + scale/2);
+                    vec3 col = samplePixel(sx, sy, sampleIndex, 1, width, height, scene, camera, *sampler);
+                    if(scale == 1){
+                        vec3& sum = accum[size_t(y)*width + x];
+                        sum = sampleIndex == 0 ? col : sum + col;
+                        storePixel(img, width, height, x, y, sum / float(sampleIndex + 1));
+                        continue;
+                    }
+                    for(int by = y; by < std::min(y1, y + scale); ++by)
+                        for(int bx = x; bx < std::min(x1, x + scale); ++bx)
+                            storePixel(img, width, height, bx, by, col);
                 }
             }
+            if(preview)
+                preview->publish(x0, height - y1, x1 - x0, y1 - y0);
+        }
+    }
+    return !cancelled;
+}
 
+// Interactive mode: renders the view of control progressively while the
+// preview is open. Whenever the camera moves the image restarts with coarse
+// passes that take a fraction of a sample per pixel, then it is refined by
+// one sample per pixel and pass up to numRaysPixel.
+void renderInteractive(std::vector<std::uint8_t> *img, int width, int height, int numRaysPixel, Surface* scene, CameraControl& control, const Sampler& sampler, PreviewBuffer *preview, ImageWriter *writer, const std::string& filename)
+{
+    const int coarseScales[] = {16, 4};
+    const int numCoarse = sizeof(coarseScales) / sizeof(coarseScales[0]);
+    std::vector<vec3> accum(size_t(width)*height);
+    unsigned version = 0;
+    int pass = 0;
+
+    std::cout << "W/S/A/D/Q/E or arrow keys move, drag orbits, the wheel zooms, [ ] change the aperture, , . the focal distance, Return saves, Escape quits" << std::endl;
+    while(preview->isOpen()){
+        unsigned current;
+        CameraView view = control.view(current);
+        if(current != version){
+            version = current;
+            pass = 0;
+        }
+        int sample = pass - numCoarse;
+
+        if(control.takeSaveRequest()){
+            std::string error;
+            if(!writer->write(filename, *img, width, height, error))
+                std::cerr << error << std::endl;
+            else
+                std::cout << "Saved " << filename << " with " << std::max(0, sample) << " samples per pixel, camera 0 " << view.lookFrom << " " << view.lookAt
+                          << " --vfov " << view.vfov << " --aperture " << view.aperture << " --focal-distance " << view.focalDistance << std::endl;
         }
+
+        if(sample >= numRaysPixel){
+            control.waitForChange(version, std::chrono::milliseconds(100));
+            continue;
+        }
+        Camera cam(view.lookFrom, view.lookAt, vec3(0,1,0), view.vfov, float(width)/float(height), view.aperture, view.focalDistance);
+        int scale = sample < 0 ? coarseScales[pass] : 1;
+        if(renderPass(img, accum, width, height, scale, std::max(0, sample), scene, cam, control, version, sampler, preview))
+            ++pass;
     }
-    list[i++] = new Sphere(vec3(0, 1, 0), 1.0, new Dielectric(1.3));
-    list[i++] = new Sphere(vec3(-4, 1, 0), 1.0, new Lambertian(vec3(0.4, 0.2, 0.1)));
-    list[i++] = new Sphere(vec3(4, 1, 0), 1.0, new Metal(vec3(0.7, 0.6, 0.5), 0.0));
+}
 
-    return new SurfaceList(list, i);
+#ifndef HEADLESS
+// Moves the camera of the interactive mode with the keyboard and the mouse.
+void controlCamera(const SDL_Event& event, CameraControl& control, bool& done){
+    if(event.type == SDL_KEYDOWN){
+        switch(event.key.keysym.sym){
+            case SDLK_w: case SDLK_UP: control.move(1, 0, 0); break;
+            case SDLK_s: case SDLK_DOWN: control.move(-1, 0, 0); break;
+            case SDLK_a: case SDLK_LEFT: control.move(0, -1, 0); break;
+            case SDLK_d: case SDLK_RIGHT: control.move(0, 1, 0); break;
+            case SDLK_q: case SDLK_PAGEDOWN: control.move(0, 0, -1); break;
+            case SDLK_e: case SDLK_PAGEUP: control.move(0, 0, 1); break;
+            case SDLK_LEFTBRACKET: control.scaleAperture(0.8f); break;
+            case SDLK_RIGHTBRACKET: control.scaleAperture(1.25f); break;
+            case SDLK_COMMA: control.scaleFocalDistance(1/1.1f); break;
+            case SDLK_PERIOD: control.scaleFocalDistance(1.1f); break;
+            case SDLK_RETURN: control.requestSave(); break;
+            case SDLK_ESCAPE: done = true; break;
+            default: break;
+        }
+    }else if(event.type == SDL_MOUSEMOTION && (event.motion.state & SDL_BUTTON_LMASK)){
+        control.orbit(0.005f * event.motion.xrel, 0.005f * event.motion.yrel);
+    }else if(event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_WHEELUP){
+        control.zoom(1/1.1f);
+    }else if(event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_WHEELDOWN){
+        control.zoom(1.1f);
+    }
 }
 
-int preview(std::vector<std::uint8_t> *img, int width, int height, int pwidth, int pheight){
+int preview(PreviewBuffer *buffer, int pwidth, int pheight, CameraControl *control){
 
+    int width = buffer->getWidth();
+    int height = buffer->getHeight();
     if(pwidth > width)
         pwidth = width;
     if(pheight > height)
         pheight = height;
 
     if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE) < 0) {
-        std::cout << "Error: Unable to init SDL: " << SDL_GetError() << std::endl;
+        std::cerr << "Error: Unable to init SDL: " << SDL_GetError() << std::endl;
+        buffer->close();
         return 1;
     }
 
     SDL_Surface* scr = SDL_SetVideoMode(pwidth, pheight, 32, SDL_OPENGL);
 
     if(scr == 0) {
-        std::cout << "Error: Unable to set video. SDL error message: " << SDL_GetError() << std::endl;
+        std::cerr << "Error: Unable to set video. SDL error message: " << SDL_GetError() << std::endl;
+        buffer->close();
         return 1;
     }
 
@@ -231,7 +771,8 @@ int preview(std::vector<std::uint8_t> *img, int width, int height, int pwidth, i
     glDisable(GL_ALPHA_TEST);
 
     if(glGetError() != GL_NO_ERROR) {
-        std::cout << "Error initing GL" << std::endl;
+        std::cerr << "Error initing GL" << std::endl;
+        buffer->close();
         return 1;
     }
 
@@ -240,29 +781,36 @@ int preview(std::vector<std::uint8_t> *img, int width, int height, int pwidth, i
     double u3 = (double)width / u2;
     double v3 = (double)height / v2;
 
-    std::vector<unsigned char> image2(u2 * v2 * 4);
-
     glEnable(GL_TEXTURE_2D);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, 4, u2, v2, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image2[0]);
+    {
+        std::vector<unsigned char> black(u2 * v2 * 4);
+        glTexImage2D(GL_TEXTURE_2D, 0, 4, u2, v2, 0, GL_RGBA, GL_UNSIGNED_BYTE, &black[0]);
+    }
 
     bool done = false;
     SDL_Event event = {0};
+    if(control)
+        SDL_EnableKeyRepeat(SDL_DEFAULT_REPEAT_DELAY, SDL_DEFAULT_REPEAT_INTERVAL);
     glColor4ub(255, 255, 255, 255);
+    std::vector<PreviewRegion> regions;
+    std::vector<std::uint8_t> pixels;
 
     while(!done) {
         while(SDL_PollEvent(&event)) {
             if(event.type == SDL_QUIT) done = 1;
+            else if(control) controlCamera(event, *control, done);
         }
-        for(size_t y = 0; y < height; y++) {
-            for (size_t x = 0; x < width; x++) {
-                for (size_t c = 0; c < 4; c++) {
-                    image2[4 * u2 * y + 4 * x + c] = (*img)[4 * width * y + 4 * x + c];
-                }
+        // only the tiles finished since the last frame are uploaded
+        if(buffer->takeDirty(regions, pixels)){
+            size_t offset = 0;
+            for(size_t i = 0; i < regions.size(); ++i){
+                const PreviewRegion& r = regions[i];
+                glTexSubImage2D(GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[offset]);
+                offset += size_t(r.width) * r.height * 4;
             }
         }
-        glTexImage2D(GL_TEXTURE_2D, 0, 4, u2, v2, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image2[0]);
         glBegin(GL_QUADS);
         glTexCoord2d( 0,  0); glVertex2f(    0,      0);
         glTexCoord2d(u3,  0); glVertex2f(width,      0);
@@ -277,5 +825,7 @@ int preview(std::vector<std::uint8_t> *img, int width, int height, int pwidth, i
         SDL_Delay(16);
     }
 
+    buffer->close();
     return 0;
 }
+#endif
@@ -5,20 +5,45 @@
 #include "math_util.h"
 #include "surface_list.h"
 
+enum MaterialType{
+    LAMBERTIAN,
+    METAL,
+    DIELECTRIC,
+    NUM_MATERIAL_TYPES
+};
+
+static_assert(NUM_MATERIAL_TYPES == statsMaterialTypes, "statsMaterialNames in stats.h lists every material type");
+
 class Material{
     public:
-        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered) const = 0;
+        virtual ~Material(){}
+        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered, Sampler& sampler) const = 0;
+        virtual MaterialType getType() const = 0;
+        virtual vec3 getAlbedo() const = 0;
+        // Mirror-like surfaces show the surfaces they reflect or refract, the
+        // denoiser takes its features from those instead.
+        virtual bool isSpecular() const = 0;
 };
 
 class Lambertian : public Material{
     public:
         Lambertian(const vec3& a): albedo(a){}
-        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered) const{
-            vec3 target = hitRec.p + hitRec.normal + randomUnitSphere();
-            scattered = Ray(hitRec.p, target - hitRec.p);
+        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered, Sampler& sampler) const{
+            float u1, u2;
+            sampler.get2D(u1, u2);
+            scattered = Ray(hitRec.p, toWorld(sampleCosineHemisphere(u1, u2), hitRec.normal));
             attenuation = albedo;
             return true;
         }
+        virtual MaterialType getType() const{
+            return LAMBERTIAN;
+        }
+        virtual vec3 getAlbedo() const{
+            return albedo;
+        }
+        virtual bool isSpecular() const{
+            return false;
+        }
         vec3 albedo;
 };
 
@@ -31,12 +56,32 @@ class Metal: public Material{
                 fuzz = 1;
         }
 
-        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered) const{
-            vec3 reflected = reflect(unitVector(inRay.getDirection()), hitRec.normal);
-            scattered = Ray(hitRec.p, reflected + fuzz*randomUnitSphere());
+        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered, Sampler& sampler) const{
+            // fuzz is the roughness of a GGX microfacet lobe, the surface is
+            // mirrored at a sampled microfacet normal
+            float u1, u2;
+            sampler.get2D(u1, u2);
+            vec3 microNormal = toWorld(sampleGGXNormal(fuzz, u1, u2), hitRec.normal);
+            vec3 reflected = reflect(unitVector(inRay.getDirection()), microNormal);
+            scattered = Ray(hitRec.p, reflected);
             attenuation = albedo;
             return (dot(scattered.getDirection(), hitRec.normal) > 0);
         }
+        virtual MaterialType getType() const{
+            return METAL;
+        }
+        virtual vec3 getAlbedo() const{
+            return albedo;
+        }
+        // Up to this GGX roughness the median microfacet normal is tilted by
+        // less than atan(0.2), about 11 degrees, so the reflection is still a
+        // recognizable, if blurred, image of other surfaces and the denoiser
+        // follows it. Rougher metal looks diffuse and guides it by itself.
+        static constexpr float specularFuzz = 0.2f;
+
+        virtual bool isSpecular() const{
+            return fuzz < specularFuzz;
+        }
         vec3 albedo;
         float fuzz;
 };
@@ -46,7 +91,7 @@ class Dielectric: public Material{
         Dielectric(float ri): refractionIndex(ri){ albedo = vec3(1.0, 1.0, 1.0); }
         Dielectric(float ri, const vec3& a): refractionIndex(ri), albedo(a){}
 
-        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered) const{
+        virtual bool scatter(const Ray& inRay, const hitRecord& hitRec, vec3& attenuation, Ray& scattered, Sampler& sampler) const{
             vec3 outNormal;
             vec3 reflected = reflect(inRay.getDirection(), hitRec.normal);
             float refractionRatio;
@@ -72,13 +117,23 @@ class Dielectric: public Material{
                 reflectionProbability = 1.0;
             }
 
-            if(drand48() < reflectionProbability){
+            sampler.skip(2);
+            if(sampler.get1D() < reflectionProbability){
                 scattered = Ray(hitRec.p, reflected);
             }else{
                 scattered = Ray(hitRec.p, refracted);
             }
             return true;
         }
+        virtual MaterialType getType() const{
+            return DIELECTRIC;
+        }
+        virtual vec3 getAlbedo() const{
+            return albedo;
+        }
+        virtual bool isSpecular() const{
+            return true;
+        }
         float refractionIndex;
         vec3 albedo;
 };
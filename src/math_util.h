@@ -1,21 +1,21 @@
 #ifndef MATHUTILH
 #define MATHUTILH
 #include "vec3.h"
+#include "sampler.h"
+#include "sampling.h"
 #include <random>
 
-vec3 randomUnitSphere(){
-    vec3 p;
-    do {
-        p = 2.0*vec3(drand48(), drand48(), drand48()) - vec3(1,1,1);
-    }while(p.squaredLength() >= 1.0);
-    return p;
+inline vec3 randomUnitSphere(Sampler& sampler){
+    float u1, u2;
+    sampler.get2D(u1, u2);
+    return sampleUniformBall(u1, u2, sampler.get1D());
 }
 
-vec3 reflect(const vec3& v, const vec3& n){
+inline vec3 reflect(const vec3& v, const vec3& n){
     return v - 2*dot(v,n)*n;
 }
 
-bool refract(const vec3& v, const vec3& n, float refractionRatio, vec3& refracted){
+inline bool refract(const vec3& v, const vec3& n, float refractionRatio, vec3& refracted){
     vec3 uv = unitVector(v);
     float dt = dot(uv, n);
     float discriminant = 1.0 - refractionRatio*refractionRatio*(1-dt*dt);
@@ -27,7 +27,7 @@ bool refract(const vec3& v, const vec3& n, float refractionRatio, vec3& refracte
     }
 }
 
-float schlick(float cosine, float refractionIndex){
+inline float schlick(float cosine, float refractionIndex){
     float r0 = (1-refractionIndex)/(1+refractionIndex);
     r0 = r0*r0;
     return r0 + (1-r0)*pow((1-cosine),5);
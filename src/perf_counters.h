@@ -0,0 +1,134 @@
+#ifndef PERFCOUNTERSH
+#define PERFCOUNTERSH
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+// The counters read by PerfCounters. The task clock, the CPU time of the
+// thread in nanoseconds, is a software event that is also available in
+// virtual machines without access to the hardware counters.
+enum PerfCounter{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_TASK_CLOCK,
+    NUM_COUNTERS
+};
+
+// Counts of events summed over several intervals, scaled up for the time the
+// kernel multiplexed a counter with others.
+struct PerfSample{
+    PerfSample(){
+        for(int i = 0; i < NUM_COUNTERS; ++i)
+            value[i] = 0;
+    }
+
+    void merge(const PerfSample& other){
+        for(int i = 0; i < NUM_COUNTERS; ++i)
+            value[i] += other.value[i];
+    }
+
+    double value[NUM_COUNTERS];
+};
+
+// Hardware performance counters of the calling thread, in user space only,
+// read through Linux perf_event_open. Every counter is opened on its own, so
+// the ones the CPU or the kernel does not provide are simply missing. Not
+// thread-safe; every thread opens its own.
+class PerfCounters{
+    public:
+        struct Reading{
+            std::uint64_t value[NUM_COUNTERS];
+            std::uint64_t enabled[NUM_COUNTERS];
+            std::uint64_t running[NUM_COUNTERS];
+        };
+
+        static const char* name(int counter){
+            static const char *names[NUM_COUNTERS] = {"cycles", "instructions", "cache misses", "branch misses", "task clock ns"};
+            return names[counter];
+        }
+
+        PerfCounters(){
+            for(int i = 0; i < NUM_COUNTERS; ++i)
+                fds[i] = -1;
+        }
+
+        ~PerfCounters(){
+#ifdef __linux__
+            for(int i = 0; i < NUM_COUNTERS; ++i)
+                if(fds[i] >= 0)
+                    close(fds[i]);
+#endif
+        }
+
+        // Starts the counters, returns false with the reason if none of them
+        // is available.
+        bool open(std::string& error){
+#ifdef __linux__
+            const std::uint32_t types[NUM_COUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+            const std::uint64_t configs[NUM_COUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_SW_TASK_CLOCK};
+            bool any = false;
+            for(int i = 0; i < NUM_COUNTERS; ++i){
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = types[i];
+                attr.config = configs[i];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+                if(fds[i] >= 0)
+                    any = true;
+                else if(error.empty())
+                    error = std::string(name(i)) + ": " + std::strerror(errno);
+            }
+            return any;
+#else
+            error = "perf_event_open needs Linux";
+            return false;
+#endif
+        }
+
+        bool isOpen(int counter) const{
+            return fds[counter] >= 0;
+        }
+
+        void read(Reading& reading) const{
+            for(int i = 0; i < NUM_COUNTERS; ++i){
+                std::uint64_t data[3] = {0, 0, 0};
+#ifdef __linux__
+                if(fds[i] >= 0 && ::read(fds[i], data, sizeof(data)) != sizeof(data))
+                    data[0] = data[1] = data[2] = 0;
+#endif
+                reading.value[i] = data[0];
+                reading.enabled[i] = data[1];
+                reading.running[i] = data[2];
+            }
+        }
+
+        // Adds the counts between two readings to sum.
+        static void add(const Reading& start, const Reading& end, PerfSample& sum){
+            for(int i = 0; i < NUM_COUNTERS; ++i){
+                std::uint64_t running = end.running[i] - start.running[i];
+                if(running == 0)
+                    continue;
+                double scale = double(end.enabled[i] - start.enabled[i]) / running;
+                sum.value[i] += double(end.value[i] - start.value[i]) * scale;
+            }
+        }
+
+    private:
+        int fds[NUM_COUNTERS];
+};
+
+#endif
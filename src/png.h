@@ -0,0 +1,95 @@
+#ifndef PNGH
+#define PNGH
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <zlib.h>
+#include "lodepng/lodepng.h"
+#include "checksum.h"
+#include "stats.h"
+
+// zlib stream compressor for lodepng that deflates the filtered scanlines in
+// independent strips on all cores, like pigz does. Every strip but the last one
+// ends with a sync flush, i.e. an empty stored block that aligns the strip to a
+// byte boundary, so the strips can simply be concatenated to one deflate
+// stream. Each strip is primed with the last 32 KiB of its predecessor as
+// dictionary to keep the compression ratio close to a single stream, and the
+// Adler-32 checksums of the strips are combined into the one of the trailer.
+// custom_context may point to an int with the zlib compression level. The
+// hardware counters of the worker threads are added to the encode phase.
+inline unsigned parallelZlib(unsigned char **out, size_t *outsize, const unsigned char *in, size_t insize, const LodePNGCompressSettings *settings){
+    int level = settings->custom_context ? *static_cast<const int*>(settings->custom_context) : Z_DEFAULT_COMPRESSION;
+    const size_t stripSize = 128 * 1024;
+    const size_t dictionarySize = 32 * 1024;
+    int numStrips = std::max<size_t>(1, (insize + stripSize - 1) / stripSize);
+    std::vector<std::vector<unsigned char> > strips(numStrips);
+    std::vector<uLong> checksums(numStrips);
+    bool failed = false;
+    std::thread::id caller = std::this_thread::get_id();
+
+    #pragma omp parallel for schedule(dynamic) reduction(||:failed)
+    for(int i = 0; i < numStrips; ++i){
+        // the strips of the caller are counted by its own scope
+        PerfScope perf(PHASE_ENCODE, std::this_thread::get_id() != caller);
+        size_t begin = size_t(i) * stripSize;
+        size_t size = std::min(stripSize, insize - begin);
+        bool last = i == numStrips - 1;
+        checksums[i] = computeAdler32(in + begin, size);
+
+        z_stream stream = z_stream();
+        if(deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+            failed = true;
+            continue;
+        }
+        if(begin > 0){
+            size_t dictionary = std::min(dictionarySize, begin);
+            deflateSetDictionary(&stream, in + begin - dictionary, dictionary);
+        }
+
+        // room for the strip and the closing stored block
+        std::vector<unsigned char>& strip = strips[i];
+        strip.resize(deflateBound(&stream, size) + 16);
+        stream.next_in = const_cast<unsigned char*>(in + begin);
+        stream.avail_in = size;
+        stream.next_out = &strip[0];
+        stream.avail_out = strip.size();
+        int status = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if(status != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0 || stream.avail_out == 0)
+            failed = true;
+        strip.resize(strip.size() - stream.avail_out);
+        deflateEnd(&stream);
+    }
+    if(failed)
+        return 83;
+
+    uLong checksum = checksums[0];
+    size_t total = 2 + 4;
+    for(int i = 0; i < numStrips; ++i){
+        if(i > 0)
+            checksum = adler32_combine(checksum, checksums[i], std::min(stripSize, insize - size_t(i) * stripSize));
+        total += strips[i].size();
+    }
+
+    unsigned char *data = static_cast<unsigned char*>(malloc(total));
+    if(!data)
+        return 83;
+    // header of a deflate stream with a 32 KiB window, the level is a hint only
+    data[0] = 0x78;
+    data[1] = 0x9c;
+    size_t pos = 2;
+    for(int i = 0; i < numStrips; ++i){
+        std::copy(strips[i].begin(), strips[i].end(), data + pos);
+        pos += strips[i].size();
+    }
+    for(int i = 0; i < 4; ++i)
+        data[pos + i] = (checksum >> (24 - 8*i)) & 0xff;
+
+    *out = data;
+    *outsize = total;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef PREVIEWH
+#define PREVIEWH
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include "shared_framebuffer.h"
+#include "stats.h"
+
+// A rectangle of the image, the first row is the top.
+struct PreviewRegion{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// Hands finished pixels of the RGBA image to the preview thread. The render
+// threads publish rows and tiles once they are complete: the pixels are
+// copied into a front buffer and their tiles are marked dirty. The preview
+// takes the dirty tiles with their pixels, so it only uploads what changed and
+// never sees pixels that are still being written. Finished pixels are also
+// published to an attached shared framebuffer, with or without a window.
+class PreviewBuffer{
+    public:
+        static const int tileSize = 32;
+
+        PreviewBuffer(const std::vector<std::uint8_t> *img, int w, int h, bool window = true) : img(img), width(w), height(h), open(window), shared(nullptr){
+            tilesX = (w + tileSize - 1) / tileSize;
+            tilesY = (h + tileSize - 1) / tileSize;
+            front.assign(size_t(w) * h * 4, 0);
+            dirty.assign(tilesX * tilesY, false);
+            rowPixels.reset(new std::atomic<int>[h]);
+            startFrame();
+        }
+
+        void attach(SharedFramebuffer *framebuffer){
+            shared = framebuffer;
+        }
+
+        // Resets the counts of finished pixels per row, before a frame is
+        // rendered.
+        void startFrame(){
+            for(int y = 0; y < height; ++y)
+                rowPixels[y] = 0;
+        }
+
+        // Counts a finished pixel of row y in render coordinates (the first
+        // row is the bottom) and publishes the row when all of its pixels are
+        // finished.
+        void finishPixel(int y){
+            if(++rowPixels[y] == width)
+                publish(0, height - 1 - y, width, 1);
+        }
+
+        // Copies a finished rectangle of the image into the front buffer.
+        void publish(int x, int y, int w, int h){
+#ifdef NO_STATS
+            copy(x, y, w, h);
+#else
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            copy(x, y, w, h);
+            STATS_ADD(previewSeconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+#endif
+        }
+
+        // Takes the regions that changed since the last call, as runs of
+        // dirty tiles along the tile rows, and copies their pixels
+        // one region after the other into pixels.
+        bool takeDirty(std::vector<PreviewRegion>& regions, std::vector<std::uint8_t>& pixels){
+            regions.clear();
+            pixels.clear();
+            std::lock_guard<std::mutex> lock(mutex);
+            for(int ty = 0; ty < tilesY; ++ty){
+                for(int tx = 0; tx < tilesX; ++tx){
+                    if(!dirty[ty * tilesX + tx])
+                        continue;
+                    int end = tx;
+                    while(end < tilesX && dirty[ty * tilesX + end]){
+                        dirty[ty * tilesX + end] = false;
+                        ++end;
+                    }
+                    PreviewRegion region;
+                    region.x = tx * tileSize;
+                    region.y = ty * tileSize;
+                    region.width = std::min(width, end * tileSize) - region.x;
+                    region.height = std::min(height, (ty + 1) * tileSize) - region.y;
+                    for(int row = region.y; row < region.y + region.height; ++row){
+                        const std::uint8_t *begin = &front[(size_t(row) * width + region.x) * 4];
+                        pixels.insert(pixels.end(), begin, begin + size_t(region.width) * 4);
+                    }
+                    regions.push_back(region);
+                    tx = end;
+                }
+            }
+            return !regions.empty();
+        }
+
+        // Stops publishing, once the preview has ended.
+        void close(){
+            open = false;
+        }
+
+        bool isOpen() const{
+            return open;
+        }
+
+        int getWidth() const{
+            return width;
+        }
+
+        int getHeight() const{
+            return height;
+        }
+
+    private:
+        void copy(int x, int y, int w, int h){
+            if(shared)
+                shared->publish(x, y, w, h);
+            if(!open)
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            for(int row = y; row < y + h; ++row){
+                size_t offset = (size_t(row) * width + x) * 4;
+                std::memcpy(&front[offset], &(*img)[offset], size_t(w) * 4);
+            }
+            for(int ty = y / tileSize; ty <= (y + h - 1) / tileSize; ++ty)
+                for(int tx = x / tileSize; tx <= (x + w - 1) / tileSize; ++tx)
+                    dirty[ty * tilesX + tx] = true;
+        }
+
+        const std::vector<std::uint8_t> *img;
+        int width;
+        int height;
+        int tilesX;
+        int tilesY;
+        std::atomic<bool> open;
+        SharedFramebuffer *shared;
+        std::vector<std::uint8_t> front;
+        std::vector<bool> dirty;
+        std::unique_ptr<std::atomic<int>[]> rowPixels;
+        std::mutex mutex;
+};
+
+#endif
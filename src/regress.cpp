@@ -0,0 +1,222 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <sys/stat.h>
+#include <boost/program_options.hpp>
+#include "renderer.h"
+#include "hdr.h"
+#include "scenes.h"
+
+namespace po = boost::program_options;
+
+// Golden-image regression check of the renderer. Renders small fixed scenes
+// with every integrator and sampler and compares them with golden images
+// statistically instead of byte by byte, so that changes which only alter the
+// noise, such as a different order of floating point operations, a vectorized
+// intersection or another tile schedule, pass, while changes of the expected
+// image fail.
+//
+// An image is rendered as a number of batches with disjoint samples. The mean
+// of the batches estimates the expected color of every pixel and their spread
+// the standard error of that estimate. The golden images store both, rendered
+// with many more batches of the random sampler. A pixel is an outlier if it
+// differs from the golden mean by more than maxZ combined standard errors;
+// the check fails if there are too many outliers or if the image as a whole
+// is brighter or darker than the golden one by more than maxZ standard
+// errors of the image mean.
+
+// Colors are compared after clamping to [0, 1], like in the stored images, so
+// that rare very bright paths do not dominate the variance.
+float clampColor(float c)
+{
+    return std::min(1.0f, std::max(0.0f, c));
+}
+
+// Absolute difference that always passes, for pixels without noise.
+const double minDifference = 1e-4;
+
+// Per-pixel mean of the batches and the variance of that mean.
+struct BatchEstimate{
+    std::vector<vec3> mean;
+    std::vector<vec3> variance;
+};
+
+bool renderBatches(const TestScene& scene, const RenderSettings& settings, int numBatches, BatchEstimate& estimate)
+{
+    size_t size = size_t(settings.width) * settings.height;
+    std::vector<vec3> sum(size, vec3(0, 0, 0));
+    std::vector<vec3> sumSquares(size, vec3(0, 0, 0));
+    std::vector<vec3> batch;
+    for(int b = 0; b < numBatches; ++b){
+        RenderSettings batchSettings = settings;
+        batchSettings.firstSample = settings.firstSample + b * settings.numRaysPixel;
+        double seconds;
+        if(!renderTestScene(scene, batchSettings, batch, seconds))
+            return false;
+        for(size_t i = 0; i < size; ++i)
+            for(int c = 0; c < 3; ++c){
+                float v = clampColor(batch[i][c]);
+                sum[i][c] += v;
+                sumSquares[i][c] += v * v;
+            }
+    }
+    estimate.mean.resize(size);
+    estimate.variance.resize(size);
+    for(size_t i = 0; i < size; ++i)
+        for(int c = 0; c < 3; ++c){
+            double mean = sum[i][c] / numBatches;
+            double variance = std::max(0.0, (sumSquares[i][c] - numBatches * mean * mean) / (numBatches - 1));
+            estimate.mean[i][c] = mean;
+            estimate.variance[i][c] = variance / numBatches;
+        }
+    return true;
+}
+
+struct Comparison{
+    double outliers;
+    double biasZ;
+};
+
+Comparison compare(const BatchEstimate& image, const BatchEstimate& golden, double maxZ)
+{
+    Comparison result = {0, 0};
+    size_t outliers = 0;
+    double difference = 0;
+    double variance = 0;
+    for(size_t i = 0; i < image.mean.size(); ++i){
+        bool outlier = false;
+        for(int c = 0; c < 3; ++c){
+            double d = image.mean[i][c] - golden.mean[i][c];
+            double v = image.variance[i][c] + golden.variance[i][c];
+            outlier = outlier || std::fabs(d) > maxZ * std::sqrt(v) + minDifference;
+            difference += d;
+            variance += v;
+        }
+        outliers += outlier;
+    }
+    result.outliers = double(outliers) / image.mean.size();
+    result.biasZ = std::fabs(difference) / (std::sqrt(variance) + minDifference);
+    return result;
+}
+
+int main(int argc, const char *argv[])
+{
+    std::string sceneNames;
+    std::string integratorNames;
+    std::string samplerNames;
+    std::string goldenDir;
+    bool update;
+    int numBatches;
+    int goldenBatches;
+    double maxZ;
+    double maxOutliers;
+    RenderSettings settings;
+
+    po::options_description desc("Golden-image regression check of the ray tracer\n\nSupported parameters");
+    desc.add_options()
+    ("help", "print available parameters")
+    ("scenes", po::value<std::string>(&sceneNames)->default_value("default,glass"), "comma separated scenes: default, glass or large")
+    ("integrators", po::value<std::string>(&integratorNames)->default_value("recursive,wavefront"), "comma separated integrators to check")
+    ("samplers", po::value<std::string>(&samplerNames)->default_value("random,sobol,halton,bluenoise"), "comma separated samplers to check")
+    ("width", po::value<int>(&settings.width)->default_value(48), "width of the rendered images")
+    ("height", po::value<int>(&settings.height)->default_value(27), "height of the rendered images")
+    ("num-rays", po::value<int>(&settings.numRaysPixel)->default_value(4), "samples per pixel of every batch")
+    ("batches", po::value<int>(&numBatches)->default_value(16), "number of batches of the checked images")
+    ("golden-batches", po::value<int>(&goldenBatches)->default_value(128), "number of batches of new golden images")
+    ("max-z", po::value<double>(&maxZ)->default_value(4.5), "largest accepted difference in standard errors")
+    ("max-outliers", po::value<double>(&maxOutliers)->default_value(0.02), "largest accepted share of pixels differing by more than max-z standard errors")
+    ("golden", po::value<std::string>(&goldenDir)->default_value("golden"), "directory of the golden images, <scene>_<width>x<height>_mean.pfm and _variance.pfm")
+    ("update", po::bool_switch(&update)->default_value(false), "render the golden images, after an intended change of the image");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if(vm.count("help")){
+        std::cout << desc << std::endl;
+        return 1;
+    }
+    settings.seed = 42;
+    std::string error;
+    if(!settings.validate(error) || numBatches < 2 || goldenBatches < 2){
+        std::cerr << (error.empty() ? "at least two batches are needed" : error) << std::endl;
+        return 1;
+    }
+
+    if(update)
+        mkdir(goldenDir.c_str(), 0777);
+    int failures = 0;
+    std::stringstream scenes(sceneNames);
+    std::string name;
+    while(std::getline(scenes, name, ',')){
+        TestScene scene;
+        if(!createTestScene(name, scene)){
+            std::cerr << "Unknown scene '" << name << "'" << std::endl;
+            return 1;
+        }
+
+        std::ostringstream prefix;
+        prefix << goldenDir << "/" << name << "_" << settings.width << "x" << settings.height;
+        std::string meanFile = prefix.str() + "_mean.pfm";
+        std::string varianceFile = prefix.str() + "_variance.pfm";
+        BatchEstimate golden;
+        // a missing golden image is a failure, rendering it from the code
+        // under test would compare the renderer with itself
+        if(!update && (!readPfm(meanFile, settings.width, settings.height, golden.mean) || !readPfm(varianceFile, settings.width, settings.height, golden.variance))){
+            std::cerr << "missing golden image " << prefix.str() << "_mean.pfm or _variance.pfm, render it with --update" << std::endl;
+            return 1;
+        }
+        if(update){
+            // independent of the samples of the checked images
+            std::cout << "Rendering the golden image of " << name << std::endl;
+            RenderSettings goldenSettings = settings;
+            goldenSettings.sampler = "random";
+            goldenSettings.seed = 1000003;
+            goldenSettings.firstSample = 1 << 24;
+            if(!renderBatches(scene, goldenSettings, goldenBatches, golden)){
+                std::cerr << "unable to render the golden image of " << name << std::endl;
+                return 1;
+            }
+            if(!writePfm(meanFile, settings.width, settings.height, golden.mean) || !writePfm(varianceFile, settings.width, settings.height, golden.variance)){
+                std::cerr << "unable to write the golden image to " << prefix.str() << std::endl;
+                return 1;
+            }
+        }
+
+        std::stringstream integrators(integratorNames);
+        std::string integrator;
+        while(std::getline(integrators, integrator, ',')){
+            std::stringstream samplers(samplerNames);
+            std::string sampler;
+            while(std::getline(samplers, sampler, ',')){
+                RenderSettings caseSettings = settings;
+                caseSettings.integrator = integrator;
+                caseSettings.sampler = sampler;
+                if(!caseSettings.validate(error)){
+                    std::cerr << error << std::endl;
+                    return 1;
+                }
+                BatchEstimate image;
+                if(!renderBatches(scene, caseSettings, numBatches, image)){
+                    std::cerr << "unable to render " << name << std::endl;
+                    return 1;
+                }
+                Comparison result = compare(image, golden, maxZ);
+                bool passed = result.outliers <= maxOutliers && result.biasZ <= maxZ;
+                failures += !passed;
+                std::cout << std::left << std::setw(10) << name << std::setw(12) << integrator << std::setw(12) << sampler << std::right
+                          << (passed ? "PASS" : "FAIL") << std::fixed << std::setprecision(2)
+                          << "  outliers " << std::setw(6) << result.outliers * 100 << "%  bias " << std::setw(6) << result.biasZ << " sigma" << std::endl;
+            }
+        }
+    }
+
+    if(failures){
+        std::cout << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All checks passed" << std::endl;
+    return 0;
+}
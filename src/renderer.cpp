@@ -0,0 +1,333 @@
+#include "renderer.h"
+#include "float.h"
+#include "sphere.h"
+#include "material.h"
+#include "wavefront.h"
+#include <algorithm>
+#include <chrono>
+#include <omp.h>
+
+vec3 color(const Ray& r, Surface *scene, int depth, Sampler& sampler, PathFeatures *features, int *rays)
+{
+    hitRecord hitRec;
+    if(rays)
+        ++*rays;
+    if(depth == 0)
+        STATS_ADD(primaryRays, 1);
+    else
+        STATS_ADD(secondaryRays, 1);
+    if(scene->hit(r, 0.001, MAXFLOAT, hitRec))
+    {
+        Ray scattered;
+        vec3 attenuation;
+        sampler.startBounce(depth);
+        if(depth < maxDepth)
+            STATS_ADD(scatterCalls[hitRec.mat->getType()], 1);
+        bool alive = depth < maxDepth && hitRec.mat->scatter(r, hitRec, attenuation, scattered, sampler);
+        if(features)
+            features->hitSurface(r, hitRec, depth, alive, attenuation);
+        if(alive)
+        {
+            return attenuation*color(scattered, scene, depth+1, sampler, features, rays);
+        }
+        else
+        {
+            STATS_ADD(pathLengths[std::min(depth + 1, int(RenderCounters::maxPathLength))], 1);
+            return vec3(0,0,0);
+        }
+    }
+    else
+    {
+        STATS_ADD(pathLengths[std::min(depth, int(RenderCounters::maxPathLength))], 1);
+        if(features)
+            features->miss(r);
+        return skyColor(r);
+    }
+}
+
+vec3 samplePixel(int x, int y, int firstSample, int numSamples, int width, int height, Surface *scene, Camera& camera, Sampler& sampler, PixelFeatures *pixel, int *rays)
+{
+    vec3 sum(0, 0, 0);
+    PathFeatures path;
+    for(int i = firstSample; i < firstSample + numSamples; ++i){
+        sampler.startPixelSample(x, y, i);
+        float du, dv;
+        sampler.get2D(du, dv);
+        Ray r = camera.getRay(float(x + du) / float(width), float(y + dv) / float(height), sampler);
+        if(pixel){
+            path.start();
+            sum += color(r, scene, 0, sampler, &path, rays);
+            pixel->add(path, i);
+        }else{
+            sum += color(r, scene, 0, sampler, nullptr, rays);
+        }
+    }
+    return sum;
+}
+
+vec3 renderPixel(int x, int y, int width, int height, int numRaysPixel, Surface *scene, Camera& camera, Sampler& sampler, Framebuffer& fb)
+{
+    PixelFeatures pixel;
+    int rays = 0;
+    std::chrono::steady_clock::time_point start;
+    if(fb.hasCost())
+        start = std::chrono::steady_clock::now();
+    vec3 col = samplePixel(x, y, 0, numRaysPixel, width, height, scene, camera, sampler,
+                           fb.hasFeatures() ? &pixel : nullptr, fb.hasCost() ? &rays : nullptr) / float(numRaysPixel);
+    fb.radiance[fb.index(x, y)] = col;
+    if(fb.hasFeatures())
+        fb.setFeatures(x, y, pixel);
+    if(fb.hasCost())
+        fb.setCost(x, y, std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count(), rays);
+    return col;
+}
+
+SurfaceList* randomScene(int varA, int varB)
+{
+    // the ground, the small spheres of the grid and the three large ones
+    int n = 4*varA*varB + 4;
+    Surface **list = new Surface*[n+1];
+    list[0] = new Sphere(vec3(0,-1000,0), 1000, new Lambertian(vec3(0.5,0.5,0.5)));
+    int i = 1;
+    for(int a = -varA; a < varA; ++a)
+    {
+        for(int b = -varB; b < varB; ++b)
+        {
+            float randMat = drand48();
+            vec3 center(a+0.9*drand48(), 0.2, b+drand48());
+            if((center-vec3(4,0.2,0)).length() > 0.9)
+            {
+                if(randMat < 0.8)
+                {
+                    list[i++] = new Sphere(center, 0.2, new Lambertian(vec3(drand48()*drand48(), drand48()*drand48(), drand48()*drand48())));
+                }
+                else if(randMat < 0.95)
+                {
+                    list[i++] = new Sphere(center, 0.2,
+                                           new Metal(vec3(0.5*(1+drand48()), 0.5*(1+drand48()), 0.5*(1+drand48())), 0.5*drand48()));
+                }
+                else
+                {
+                    list[i++] = new Sphere(center, 0.2, new Dielectric(1.5+(drand48()*2 - 1.0)));
+                }
+            }
+
+        }
+    }
+    list[i++] = new Sphere(vec3(0, 1, 0), 1.0, new Dielectric(1.3));
+    list[i++] = new Sphere(vec3(-4, 1, 0), 1.0, new Lambertian(vec3(0.4, 0.2, 0.1)));
+    list[i++] = new Sphere(vec3(4, 1, 0), 1.0, new Metal(vec3(0.7, 0.6, 0.5), 0.0));
+
+    return new SurfaceList(list, i);
+}
+
+void deleteScene(SurfaceList *scene)
+{
+    for(int i = 0; i < scene->size; ++i){
+        Sphere *sphere = static_cast<Sphere*>(scene->list[i]);
+        delete sphere->mat;
+        delete sphere;
+    }
+    delete[] scene->list;
+    delete scene;
+}
+
+bool RenderSettings::validate(std::string& error) const{
+    std::unique_ptr<Sampler> prototype(createSampler(sampler, seed));
+    if(!prototype){
+        error = "unknown sampler '" + sampler + "'";
+        return false;
+    }
+    if(integrator != "recursive" && integrator != "wavefront"){
+        error = "unknown integrator '" + integrator + "'";
+        return false;
+    }
+    if(width <= 0 || height <= 0 || numRaysPixel <= 0){
+        error = "width, height and the number of rays have to be positive";
+        return false;
+    }
+    return true;
+}
+
+RenderTask::RenderTask(Surface *scene, const Camera& camera, const RenderSettings& settings, TileCallback onTile)
+    : scene(scene), camera(camera), settings(settings), onTile(onTile), tilesDone(0), cancelled(false), paused(false), done(false){
+    tilesX = (settings.width + tileSize - 1) / tileSize;
+    tilesY = (settings.height + tileSize - 1) / tileSize;
+    fb.resize(settings.width, settings.height, false);
+    tileDone.reset(new std::atomic<bool>[tilesX * tilesY]);
+    for(int i = 0; i < tilesX * tilesY; ++i)
+        tileDone[i] = false;
+}
+
+RenderTask::~RenderTask(){
+    cancel();
+    if(thread.joinable())
+        thread.join();
+}
+
+void RenderTask::cancel(){
+    std::lock_guard<std::mutex> lock(mutex);
+    cancelled = true;
+    changed.notify_all();
+}
+
+void RenderTask::pause(){
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = true;
+}
+
+void RenderTask::resume(){
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = false;
+    changed.notify_all();
+}
+
+bool RenderTask::wait(){
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]{ return bool(done); });
+    return tilesDone == tilesX * tilesY;
+}
+
+bool RenderTask::isDone() const{
+    return done;
+}
+
+bool RenderTask::isCancelled() const{
+    return cancelled;
+}
+
+bool RenderTask::isPaused() const{
+    return paused;
+}
+
+int RenderTask::getWidth() const{
+    return settings.width;
+}
+
+int RenderTask::getHeight() const{
+    return settings.height;
+}
+
+int RenderTask::getTilesDone() const{
+    return tilesDone;
+}
+
+int RenderTask::getNumTiles() const{
+    return tilesX * tilesY;
+}
+
+float RenderTask::getProgress() const{
+    return float(tilesDone) / (tilesX * tilesY);
+}
+
+void RenderTask::readImage(std::vector<std::uint8_t>& rgba) const{
+    // the same snapshot of the flags decides which pixels are copied and which
+    // are converted, so a tile finishing in between stays transparent
+    std::vector<vec3> radiance;
+    std::vector<bool> finished;
+    copyFinishedTiles(radiance, finished);
+    rgba.assign(radiance.size() * 4, 0);
+    int width = settings.width;
+    for(int ty = 0; ty < tilesY; ++ty)
+        for(int tx = 0; tx < tilesX; ++tx){
+            if(!finished[ty * tilesX + tx])
+                continue;
+            for(int y = ty * tileSize; y < std::min(settings.height, (ty + 1) * tileSize); ++y)
+                for(int x = tx * tileSize; x < std::min(width, (tx + 1) * tileSize); ++x){
+                    size_t i = size_t(settings.height - 1 - y) * width + x;
+                    toRgba(radiance[i], &rgba[4 * i]);
+                }
+        }
+}
+
+void RenderTask::readRadiance(std::vector<vec3>& radiance) const{
+    std::vector<bool> finished;
+    copyFinishedTiles(radiance, finished);
+}
+
+void RenderTask::copyFinishedTiles(std::vector<vec3>& radiance, std::vector<bool>& finished) const{
+    int width = settings.width;
+    int height = settings.height;
+    radiance.assign(size_t(width) * height, vec3(0, 0, 0));
+    finished.assign(tilesX * tilesY, false);
+    for(int ty = 0; ty < tilesY; ++ty)
+        for(int tx = 0; tx < tilesX; ++tx){
+            // the flag is set after the pixels of the tile are written
+            if(!tileDone[ty * tilesX + tx].load(std::memory_order_acquire))
+                continue;
+            finished[ty * tilesX + tx] = true;
+            for(int y = ty * tileSize; y < std::min(height, (ty + 1) * tileSize); ++y)
+                for(int x = tx * tileSize; x < std::min(width, (tx + 1) * tileSize); ++x)
+                    radiance[size_t(height - 1 - y) * width + x] = fb.radiance[fb.index(x, y)];
+        }
+}
+
+// Blocks while the task is paused, returns false once it is cancelled.
+bool RenderTask::waitWhilePaused(){
+    if(paused){
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]{ return !paused || cancelled; });
+    }
+    return !cancelled;
+}
+
+// Renders tile number tile, counted from the top row of tiles, with the
+// wavefront integrator if one is given.
+bool RenderTask::renderTile(int tile, Sampler& sampler, WavefrontIntegrator *wavefront){
+    if(!waitWhilePaused())
+        return false;
+    int width = settings.width;
+    int height = settings.height;
+    int tx = tile % tilesX;
+    int ty = tilesY - 1 - tile / tilesX;
+    int x0 = tx * tileSize, x1 = std::min(width, x0 + tileSize);
+    int y0 = ty * tileSize, y1 = std::min(height, y0 + tileSize);
+
+    if(wavefront){
+        wavefront->renderTile(x0, y0, x1, y1, sampler, nullptr, &fb, nullptr);
+    }else{
+        for(int y = y0; y < y1; ++y)
+            for(int x = x0; x < x1; ++x)
+                renderPixel(x, y, width, height, settings.numRaysPixel, scene, camera, sampler, fb);
+    }
+
+    tileDone[ty * tilesX + tx].store(true, std::memory_order_release);
+    int finished = ++tilesDone;
+    if(onTile){
+        TileProgress progress = {x0, height - y1, x1 - x0, y1 - y0, finished, tilesX * tilesY};
+        onTile(progress);
+    }
+    return true;
+}
+
+void RenderTask::run(){
+    int numTiles = tilesX * tilesY;
+    int threads = settings.threads > 0 ? settings.threads : omp_get_max_threads();
+    bool wavefront = settings.integrator == "wavefront";
+
+    #pragma omp parallel num_threads(threads)
+    {
+        std::unique_ptr<Sampler> sampler(createSampler(settings.sampler, settings.seed));
+        sampler->firstSample = settings.firstSample;
+        std::unique_ptr<WavefrontIntegrator> integrator;
+        if(wavefront)
+            integrator.reset(new WavefrontIntegrator(scene, camera, settings.width, settings.height, settings.numRaysPixel, settings.reorder));
+
+        #pragma omp for schedule(dynamic)
+        for(int tile = 0; tile < numTiles; ++tile)
+            if(!cancelled)
+                renderTile(tile, *sampler, integrator.get());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    changed.notify_all();
+}
+
+std::shared_ptr<RenderTask> Renderer::renderAsync(Surface *scene, const Camera& camera, const RenderSettings& settings, std::string& error, TileCallback onTile){
+    if(!settings.validate(error))
+        return std::shared_ptr<RenderTask>();
+    std::shared_ptr<RenderTask> task(new RenderTask(scene, camera, settings, onTile));
+    task->thread = std::thread(&RenderTask::run, task.get());
+    return task;
+}
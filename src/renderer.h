@@ -0,0 +1,145 @@
+#ifndef RENDERERH
+#define RENDERERH
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include "camera.h"
+#include "surface.h"
+#include "surface_list.h"
+#include "integrator.h"
+#include "framebuffer.h"
+
+class WavefrontIntegrator;
+
+// Radiance along r. If features are given they are updated at every hit, if
+// rays is given it is incremented for every ray traced.
+vec3 color(const Ray& r, Surface *scene, int depth, Sampler& sampler, PathFeatures *features, int *rays = nullptr);
+
+// Traces the samples firstSample to firstSample + numSamples - 1 of pixel
+// (x, y) of a width x height frame and returns their sum. If pixel is given
+// the features of the paths are added to it, if rays is given it is
+// incremented for every ray traced.
+vec3 samplePixel(int x, int y, int firstSample, int numSamples, int width, int height, Surface *scene, Camera& camera, Sampler& sampler, PixelFeatures *pixel = nullptr, int *rays = nullptr);
+
+// Renders pixel (x, y) with numRaysPixel samples into fb, with the features
+// and the render cost if fb records them, and returns its radiance.
+vec3 renderPixel(int x, int y, int width, int height, int numRaysPixel, Surface *scene, Camera& camera, Sampler& sampler, Framebuffer& fb);
+
+// The scene of random spheres around three large ones, drawn with drand48.
+SurfaceList* randomScene(int varA, int varB);
+// Frees a scene of randomScene with its spheres and materials.
+void deleteScene(SurfaceList *scene);
+
+struct RenderSettings{
+    RenderSettings() : width(1280), height(720), numRaysPixel(100), sampler("random"), seed(42), integrator("recursive"), reorder(false), firstSample(0), threads(0){}
+
+    // Checks the names of the sampler and the integrator and the sizes.
+    bool validate(std::string& error) const;
+
+    int width;
+    int height;
+    int numRaysPixel;
+    std::string sampler;
+    int seed;
+    // recursive or wavefront
+    std::string integrator;
+    bool reorder;
+    // index of the first sample of every pixel
+    int firstSample;
+    // number of render threads, 0 for the OpenMP default
+    int threads;
+};
+
+// A finished tile, in image coordinates with the first row at the top.
+struct TileProgress{
+    int x;
+    int y;
+    int width;
+    int height;
+    int tilesDone;
+    int numTiles;
+};
+
+// A frame being rendered by a Renderer. The frame is rendered in tiles from
+// the top; cancel and pause take effect at the start of the next tile, and the
+// finished tiles can be read back at any time.
+class RenderTask{
+    public:
+        static const int tileSize = 16;
+
+        ~RenderTask();
+
+        void cancel();
+        void pause();
+        void resume();
+
+        // Waits until the frame is finished or cancelled and returns whether
+        // all tiles were rendered.
+        bool wait();
+        bool isDone() const;
+        bool isCancelled() const;
+        bool isPaused() const;
+
+        int getWidth() const;
+        int getHeight() const;
+        int getTilesDone() const;
+        int getNumTiles() const;
+        float getProgress() const;
+
+        // Copies the finished tiles as RGBA image with the first row at the
+        // top; pixels of tiles that are not finished are transparent black.
+        void readImage(std::vector<std::uint8_t>& rgba) const;
+        // Copies the linear radiance of the finished tiles, the first row at
+        // the top, zero elsewhere.
+        void readRadiance(std::vector<vec3>& radiance) const;
+
+    private:
+        friend class Renderer;
+        typedef std::function<void(const TileProgress&)> TileCallback;
+
+        RenderTask(Surface *scene, const Camera& camera, const RenderSettings& settings, TileCallback onTile);
+        void run();
+        bool waitWhilePaused();
+        // Copies the radiance of the finished tiles like readRadiance and
+        // the flags of the tiles it copied.
+        void copyFinishedTiles(std::vector<vec3>& radiance, std::vector<bool>& finished) const;
+        bool renderTile(int tile, Sampler& sampler, WavefrontIntegrator *wavefront);
+
+        Surface *scene;
+        Camera camera;
+        RenderSettings settings;
+        TileCallback onTile;
+        int tilesX;
+        int tilesY;
+        Framebuffer fb;
+        std::unique_ptr<std::atomic<bool>[]> tileDone;
+        std::atomic<int> tilesDone;
+        std::atomic<bool> cancelled;
+        std::atomic<bool> paused;
+        std::atomic<bool> done;
+        mutable std::mutex mutex;
+        std::condition_variable changed;
+        std::thread thread;
+};
+
+// Renders frames asynchronously for tools that embed the ray tracer. Every
+// frame runs on its own thread with its own OpenMP team; the scene has to stay
+// alive until the frame is done.
+class Renderer{
+    public:
+        typedef RenderTask::TileCallback TileCallback;
+
+        // Starts rendering and returns at once, or returns nullptr and sets
+        // error if the settings are invalid. onTile is called by the render
+        // threads, possibly concurrently, after every finished tile.
+        std::shared_ptr<RenderTask> renderAsync(Surface *scene, const Camera& camera, const RenderSettings& settings, std::string& error, TileCallback onTile = TileCallback());
+};
+
+#endif
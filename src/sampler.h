@@ -0,0 +1,389 @@
+#ifndef SAMPLERH
+#define SAMPLERH
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <memory>
+
+// Integer hash (lowbias32 by Chris Wellons) used to derive per-pixel and
+// per-dimension seeds.
+inline uint32_t hashUInt(uint32_t x){
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+inline uint32_t hashCombine(uint32_t seed, uint32_t v){
+    return hashUInt(seed ^ (v + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+inline uint32_t reverseBits(uint32_t x){
+    x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+    x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+    x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+    x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Finalizer of SplitMix64 (Steele, Lea and Flood, "Fast Splittable
+// Pseudorandom Number Generators", OOPSLA 2014).
+inline uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+const uint64_t goldenGamma = 0x9e3779b97f4a7c15ULL;
+
+// Maps 32 random bits to [0,1).
+inline float bitsToFloat(uint32_t x){
+    return std::min(float(x) * 2.3283064365386963e-10f, 0.99999994f);
+}
+
+// Owen scrambling via the hash-based permutation of Laine and Karras as
+// refined by Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020).
+inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed){
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return x;
+}
+
+inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed){
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+// First two dimensions of the Sobol sequence, which form a (0,2)-sequence.
+inline uint32_t sobol2D(uint32_t index, int dim){
+    if(dim == 0)
+        return reverseBits(index);
+    uint32_t v = 1U << 31;
+    uint32_t result = 0;
+    for(; index; index >>= 1, v ^= v >> 1)
+        if(index & 1)
+            result ^= v;
+    return result;
+}
+
+// Source of the random numbers of a path. Each sample of a pixel consumes
+// consecutive dimensions: the pixel jitter, the lens position and then a
+// fixed block for every bounce (a 2D direction sample and a 1D choice), so
+// that the same dimension always drives the same decision. The samples of a
+// pixel are numbered from firstSample on, so the samples of a pixel can be
+// split into ranges that are rendered separately.
+class Sampler{
+    public:
+        static const int cameraDimensions = 4;
+        static const int bounceDimensions = 4;
+
+        Sampler(uint32_t s) : seed(s), firstSample(0), pixelX(0), pixelY(0), sampleIndex(0), dimension(0){}
+        virtual ~Sampler(){}
+
+        virtual void startPixelSample(int x, int y, int index){
+            pixelX = x;
+            pixelY = y;
+            sampleIndex = firstSample + index;
+            dimension = 0;
+        }
+
+        virtual float get1D() = 0;
+
+        void skip(int n){
+            dimension += n;
+        }
+
+        void startBounce(int depth){
+            dimension = cameraDimensions + depth*bounceDimensions;
+        }
+
+        // 2D samples start at an even dimension so that pairs of a sequence
+        // are kept together.
+        void get2D(float& u, float& v){
+            if(dimension & 1)
+                ++dimension;
+            u = get1D();
+            v = get1D();
+        }
+
+        virtual Sampler* clone() const = 0;
+
+        uint32_t seed;
+        int firstSample;
+        int pixelX;
+        int pixelY;
+        int sampleIndex;
+        int dimension;
+};
+
+// Independent uniform samples from a counter-based generator: every value is
+// a hash of seed, pixel, sample index and dimension, SplitMix64 keyed by the
+// sample and counting the dimensions. Unlike a shared stream such as drand48
+// the result does not depend on the order in which the pixels are rendered,
+// and any sample can be recomputed on its own.
+class RandomSampler : public Sampler{
+    public:
+        RandomSampler(uint32_t s) : Sampler(s), sampleKey(0){}
+        virtual void startPixelSample(int x, int y, int index){
+            Sampler::startPixelSample(x, y, index);
+            uint64_t key = mix64(uint64_t(seed) + goldenGamma);
+            key = mix64(key ^ (uint64_t(uint32_t(x)) << 32 | uint32_t(y)));
+            sampleKey = mix64(key ^ uint32_t(sampleIndex));
+        }
+        virtual float get1D(){
+            ++dimension;
+            return bitsToFloat(uint32_t(mix64(sampleKey + dimension * goldenGamma) >> 32));
+        }
+        virtual Sampler* clone() const{
+            return new RandomSampler(*this);
+        }
+
+        uint64_t sampleKey;
+};
+
+// Padded Sobol sampler: every pair of dimensions uses the (0,2)-sequence of
+// the first two Sobol dimensions, with the sample index shuffled and the
+// values Owen-scrambled per pixel and per dimension.
+class SobolSampler : public Sampler{
+    public:
+        SobolSampler(uint32_t s) : Sampler(s){}
+        virtual void startPixelSample(int x, int y, int index){
+            Sampler::startPixelSample(x, y, index);
+            pixelSeed = hashCombine(hashCombine(seed, x), y);
+        }
+        virtual float get1D(){
+            int pair = dimension / 2;
+            int component = dimension % 2;
+            ++dimension;
+            uint32_t index = nestedUniformScramble(sampleIndex, hashCombine(pixelSeed, pair));
+            uint32_t x = sobol2D(index, component);
+            return bitsToFloat(nestedUniformScramble(x, hashCombine(pixelSeed, 0x10000 + 2*pair + component)));
+        }
+        virtual Sampler* clone() const{
+            return new SobolSampler(*this);
+        }
+
+        uint32_t pixelSeed;
+};
+
+// Halton sequence with one prime base per dimension. The digits of every
+// dimension are scrambled by a random permutation, which breaks up the
+// correlation of the large bases at low sample counts, and every pixel gets
+// its own Cranley-Patterson rotation.
+class HaltonSampler : public Sampler{
+    public:
+        static const int numPrimes = 32;
+
+        HaltonSampler(uint32_t s) : Sampler(s), permutations(new std::vector<uint16_t>()){
+            for(int d = 0; d < numPrimes; ++d){
+                int base = prime(d);
+                size_t offset = permutations->size();
+                for(int i = 0; i < base; ++i)
+                    permutations->push_back(i);
+                for(int i = base - 1; i > 0; --i)
+                    std::swap((*permutations)[offset + i], (*permutations)[offset + hashCombine(hashCombine(seed, d), i) % (i + 1)]);
+            }
+        }
+        virtual void startPixelSample(int x, int y, int index){
+            Sampler::startPixelSample(x, y, index);
+            pixelSeed = hashCombine(hashCombine(seed, x), y);
+        }
+        virtual float get1D(){
+            int dim = dimension++;
+            // dimensions beyond the prime table restart with an offset index
+            uint32_t index = sampleIndex + (dim / numPrimes) * 7919U;
+            float v = scrambledRadicalInverse(dim % numPrimes, index) + bitsToFloat(hashCombine(pixelSeed, dim));
+            return v >= 1 ? v - 1 : v;
+        }
+        virtual Sampler* clone() const{
+            return new HaltonSampler(*this);
+        }
+
+        static int prime(int i){
+            static const int primes[numPrimes] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+                                                  59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131};
+            return primes[i];
+        }
+
+        float scrambledRadicalInverse(int d, uint32_t index) const{
+            int base = prime(d);
+            const uint16_t *perm = &(*permutations)[permutationOffset(d)];
+            float invBase = 1.0f / base;
+            float invBaseN = 1;
+            uint64_t reversed = 0;
+            // trailing zero digits are permuted as well, so continue until
+            // their contribution drops below float precision
+            while(1 - (base - 1) * invBaseN < 1){
+                uint32_t next = index / base;
+                reversed = reversed * base + perm[index - next * base];
+                invBaseN *= invBase;
+                index = next;
+            }
+            return std::min(float(reversed * invBaseN), 0.99999994f);
+        }
+
+        static int permutationOffset(int d){
+            int offset = 0;
+            for(int i = 0; i < d; ++i)
+                offset += prime(i);
+            return offset;
+        }
+
+        std::shared_ptr<std::vector<uint16_t> > permutations;
+        uint32_t pixelSeed;
+};
+
+// Tileable blue-noise threshold mask built with Ulichney's void-and-cluster
+// method on a torus.
+class BlueNoiseMask{
+    public:
+        static const int size = 64;
+
+        static const BlueNoiseMask& instance(){
+            static BlueNoiseMask mask;
+            return mask;
+        }
+
+        float operator()(int x, int y) const{
+            return values[(y & (size - 1)) * size + (x & (size - 1))];
+        }
+
+        std::vector<float> values;
+
+    private:
+        BlueNoiseMask(){
+            const int n = size * size;
+            const float sigma = 1.5f;
+            std::vector<float> kernel(n);
+            for(int dy = 0; dy < size; ++dy){
+                for(int dx = 0; dx < size; ++dx){
+                    int wx = std::min(dx, size - dx);
+                    int wy = std::min(dy, size - dy);
+                    kernel[dy * size + dx] = expf(-(wx*wx + wy*wy) / (2*sigma*sigma));
+                }
+            }
+
+            std::vector<char> pattern(n, 0);
+            std::vector<float> energy(n, 0.0f);
+            std::vector<int> rank(n, 0);
+
+            // initial pattern: 10% of the pixels set, chosen by hash
+            int ones = 0;
+            for(int i = 0; i < n; ++i){
+                if(hashUInt(i + 1) % 10 == 0){
+                    pattern[i] = 1;
+                    splat(energy, kernel, i, 1);
+                    ++ones;
+                }
+            }
+            // relax: move the tightest cluster to the largest void until stable
+            for(int iteration = 0; iteration < n; ++iteration){
+                int cluster = extremum(energy, pattern, 1);
+                pattern[cluster] = 0;
+                splat(energy, kernel, cluster, -1);
+                int v = extremum(energy, pattern, 0);
+                pattern[v] = 1;
+                splat(energy, kernel, v, 1);
+                if(v == cluster)
+                    break;
+            }
+
+            // phase 1: rank the initial points by removing tightest clusters
+            std::vector<char> initial = pattern;
+            std::vector<float> initialEnergy = energy;
+            for(int r = ones - 1; r >= 0; --r){
+                int cluster = extremum(energy, pattern, 1);
+                pattern[cluster] = 0;
+                splat(energy, kernel, cluster, -1);
+                rank[cluster] = r;
+            }
+            // phase 2 and 3: fill the largest voids until the mask is complete
+            pattern = initial;
+            energy = initialEnergy;
+            for(int r = ones; r < n; ++r){
+                int v = extremum(energy, pattern, 0);
+                pattern[v] = 1;
+                splat(energy, kernel, v, 1);
+                rank[v] = r;
+            }
+
+            values.resize(n);
+            for(int i = 0; i < n; ++i)
+                values[i] = (rank[i] + 0.5f) / n;
+        }
+
+        static void splat(std::vector<float>& energy, const std::vector<float>& kernel, int i, float sign){
+            int px = i % size;
+            int py = i / size;
+            for(int y = 0; y < size; ++y){
+                int dy = (y - py) & (size - 1);
+                for(int x = 0; x < size; ++x){
+                    int dx = (x - px) & (size - 1);
+                    energy[y * size + x] += sign * kernel[dy * size + dx];
+                }
+            }
+        }
+
+        // Tightest cluster (maximum energy among set pixels) or largest void
+        // (minimum energy among empty pixels).
+        static int extremum(const std::vector<float>& energy, const std::vector<char>& pattern, char set){
+            int best = -1;
+            for(int i = 0; i < int(energy.size()); ++i){
+                if(pattern[i] != set)
+                    continue;
+                if(best < 0 || (set ? energy[i] > energy[best] : energy[i] < energy[best]))
+                    best = i;
+            }
+            return best;
+        }
+};
+
+// Owen-scrambled Sobol points shared by all pixels and dithered per pixel by a
+// Cranley-Patterson rotation read from a blue-noise mask, so that the error
+// of neighbouring pixels is negatively correlated. Every dimension reads the
+// mask at a different toroidal offset.
+class BlueNoiseSampler : public Sampler{
+    public:
+        BlueNoiseSampler(uint32_t s) : Sampler(s), mask(BlueNoiseMask::instance()){}
+        virtual float get1D(){
+            int pair = dimension / 2;
+            int component = dimension % 2;
+            int dim = dimension++;
+            uint32_t index = nestedUniformScramble(sampleIndex, hashCombine(seed, pair));
+            uint32_t x = nestedUniformScramble(sobol2D(index, component), hashCombine(seed, 0x10000 + dim));
+            uint32_t offset = hashCombine(seed, 0x20000 + dim);
+            float v = bitsToFloat(x) + mask(pixelX + (offset & 0xff), pixelY + (offset >> 8 & 0xff));
+            return v >= 1 ? v - 1 : v;
+        }
+        virtual Sampler* clone() const{
+            return new BlueNoiseSampler(*this);
+        }
+
+        const BlueNoiseMask& mask;
+};
+
+// Returns a new sampler for the --sampler option or nullptr for unknown names.
+inline Sampler* createSampler(const std::string& name, uint32_t seed){
+    if(name == "random")
+        return new RandomSampler(seed);
+    if(name == "sobol")
+        return new SobolSampler(seed);
+    if(name == "halton")
+        return new HaltonSampler(seed);
+    if(name == "bluenoise")
+        return new BlueNoiseSampler(seed);
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef SAMPLINGH
+#define SAMPLINGH
+
+#include "vec3.h"
+
+// Closed-form warps from uniform samples in [0,1)^n to common domains. Each
+// warp consumes a fixed number of dimensions and avoids data dependent
+// branches (the selects compile to blends), so that the sample loops
+// vectorize and stratification of the input samples is preserved.
+
+// Shirley-Chiu concentric mapping of the unit square to the unit disk.
+inline vec3 sampleConcentricDisk(float u1, float u2){
+    float a = 2*u1 - 1;
+    float b = 2*u2 - 1;
+    bool major = a*a > b*b;
+    float r = major ? a : b;
+    float denominator = major ? a : b;
+    float numerator = major ? b : a;
+    float ratio = numerator / (denominator == 0 ? 1 : denominator);
+    float phi = major ? float(M_PI/4)*ratio : float(M_PI/2) - float(M_PI/4)*ratio;
+    return vec3(r*cosf(phi), r*sinf(phi), 0);
+}
+
+inline vec3 sampleUniformSphere(float u1, float u2){
+    float z = 1 - 2*u1;
+    float r = sqrtf(fmaxf(0, 1 - z*z));
+    float phi = 2*float(M_PI)*u2;
+    return vec3(r*cosf(phi), r*sinf(phi), z);
+}
+
+// Uniform point inside the unit ball.
+inline vec3 sampleUniformBall(float u1, float u2, float u3){
+    return cbrtf(u3)*sampleUniformSphere(u1, u2);
+}
+
+// Cosine-weighted direction around +z (Malley's method).
+inline vec3 sampleCosineHemisphere(float u1, float u2){
+    vec3 d = sampleConcentricDisk(u1, u2);
+    float z = sqrtf(fmaxf(0, 1 - d.x()*d.x() - d.y()*d.y()));
+    return vec3(d.x(), d.y(), z);
+}
+
+// Microfacet normal around +z distributed by the GGX (Trowbridge-Reitz)
+// normal distribution with roughness alpha.
+inline vec3 sampleGGXNormal(float alpha, float u1, float u2){
+    float tan2Theta = alpha*alpha*u1 / (1 - u1);
+    float cosTheta = 1 / sqrtf(1 + tan2Theta);
+    float sinTheta = sqrtf(fmaxf(0, 1 - cosTheta*cosTheta));
+    float phi = 2*float(M_PI)*u2;
+    return vec3(sinTheta*cosf(phi), sinTheta*sinf(phi), cosTheta);
+}
+
+// Branchless orthonormal basis around the unit vector n from Duff et al.,
+// "Building an Orthonormal Basis, Revisited" (JCGT 2017).
+inline void orthonormalBasis(const vec3& n, vec3& t, vec3& b){
+    float sign = copysignf(1.0f, n.z());
+    float a = -1.0f / (sign + n.z());
+    float c = n.x()*n.y()*a;
+    t = vec3(1.0f + sign*n.x()*n.x()*a, sign*c, -sign*n.x());
+    b = vec3(c, sign + n.y()*n.y()*a, -n.y());
+}
+
+// Transforms a direction given around +z to the frame around n.
+inline vec3 toWorld(const vec3& local, const vec3& n){
+    vec3 t, b;
+    orthonormalBasis(n, t, b);
+    return local.x()*t + local.y()*b + local.z()*n;
+}
+
+#endif
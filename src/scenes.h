@@ -0,0 +1,56 @@
+#ifndef SCENESH
+#define SCENESH
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include "renderer.h"
+#include "sphere.h"
+#include "material.h"
+
+// The fixed scenes of the benchmark and regression tools, all seen from the
+// default camera.
+struct TestScene{
+    std::string name;
+    SurfaceList *surfaces;
+};
+
+// The default scene, the default scene with half of the small spheres made of
+// glass, and a scene with about 3600 small spheres, all built from seed 42.
+inline bool createTestScene(const std::string& name, TestScene& scene){
+    scene.name = name;
+    srand48(42);
+    if(name == "default"){
+        scene.surfaces = randomScene(11, 11);
+    }else if(name == "glass"){
+        scene.surfaces = randomScene(11, 11);
+        // the ground and the three large spheres are kept
+        for(int i = 1; i < scene.surfaces->size - 3; ++i)
+            if(drand48() < 0.5)
+                static_cast<Sphere*>(scene.surfaces->list[i])->mat = new Dielectric(1.3 + 1.2 * drand48());
+    }else if(name == "large"){
+        scene.surfaces = randomScene(30, 30);
+    }else{
+        return false;
+    }
+    return true;
+}
+
+// Renders the scene and waits, returns the linear radiance with the first row
+// at the top and the time it took.
+inline bool renderTestScene(const TestScene& scene, const RenderSettings& settings, std::vector<vec3>& radiance, double& seconds){
+    Camera cam(vec3(13,2,3), vec3(0,0,0), vec3(0,1,0), 20, float(settings.width) / float(settings.height), 0.01, 10);
+    Renderer renderer;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string error;
+    std::shared_ptr<RenderTask> task = renderer.renderAsync(scene.surfaces, cam, settings, error);
+    if(!task || !task->wait())
+        return false;
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    task->readRadiance(radiance);
+    return true;
+}
+
+#endif
@@ -0,0 +1,537 @@
+#ifndef SERVERH
+#define SERVERH
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <list>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "vec3.h"
+
+// Largest var-a and var-b of a job; randomScene allocates 4*varA*varB+4
+// spheres, so the bound keeps a single job from exhausting the memory.
+const int maxSceneVar = 100;
+// Largest width and height of a job, for the same reason: the image and the
+// radiance of 8192x8192 pixels take 1 GB.
+const int maxImageSize = 8192;
+
+// A render job of the server, read from one line of JSON such as
+//   {"id": "shot1", "filename": "shot1.png", "width": 640, "height": 360,
+//    "num-rays": 16, "lookFrom": [13, 2, 3], "priority": 1}
+// The keys are those of the command line options, plus lookFrom, lookAt and
+// priority; missing keys keep the values given on the command line. The
+// filename is relative to the output directory of the server.
+struct RenderJob{
+    std::string id;
+    int priority;
+    std::string filename;
+    std::string format;
+    int width;
+    int height;
+    int numRaysPixel;
+    int seed;
+    int varA;
+    int varB;
+    float vfov;
+    float aperture;
+    float focalDistance;
+    vec3 lookFrom;
+    vec3 lookAt;
+    std::string sampler;
+    std::string integrator;
+    bool shuffle;
+};
+
+class ServerConnection;
+
+// Jobs are rendered by priority, jobs of the same priority in order of
+// arrival.
+struct QueuedJob{
+    RenderJob job;
+    long sequence;
+    std::shared_ptr<ServerConnection> client;
+
+    bool operator<(const QueuedJob& other) const{
+        if(job.priority != other.job.priority)
+            return job.priority < other.job.priority;
+        return sequence > other.sequence;
+    }
+};
+
+// Reads the vector at key, given as array of three numbers.
+inline bool readVector(const boost::property_tree::ptree& tree, const std::string& key, vec3& v){
+    boost::optional<const boost::property_tree::ptree&> child = tree.get_child_optional(key);
+    if(!child)
+        return true;
+    int i = 0;
+    for(boost::property_tree::ptree::const_iterator it = child->begin(); it != child->end(); ++it, ++i){
+        if(i == 3)
+            return false;
+        v[i] = it->second.get_value<float>();
+    }
+    return i == 3;
+}
+
+// Whether filename stays inside the directory it is resolved against: it is
+// not empty, not absolute and has no ".." component.
+inline bool isRelativeFilename(const std::string& filename){
+    if(filename.empty() || filename[0] == '/')
+        return false;
+    std::stringstream parts(filename);
+    std::string part;
+    while(std::getline(parts, part, '/'))
+        if(part == "..")
+            return false;
+    return true;
+}
+
+// Parses a job, missing values are taken from defaults.
+inline bool parseJob(const boost::property_tree::ptree& tree, const RenderJob& defaults, RenderJob& job, std::string& error){
+    job = defaults;
+    try{
+        job.id = tree.get("id", "");
+        job.priority = tree.get("priority", 0);
+        job.filename = tree.get<std::string>("filename");
+        job.format = tree.get("format", defaults.format);
+        job.width = tree.get("width", defaults.width);
+        job.height = tree.get("height", defaults.height);
+        job.numRaysPixel = tree.get("num-rays", defaults.numRaysPixel);
+        job.seed = tree.get("seed", defaults.seed);
+        job.varA = tree.get("var-a", defaults.varA);
+        job.varB = tree.get("var-b", defaults.varB);
+        job.vfov = tree.get("vfov", defaults.vfov);
+        job.aperture = tree.get("aperture", defaults.aperture);
+        job.focalDistance = tree.get("focal-distance", defaults.focalDistance);
+        job.sampler = tree.get("sampler", defaults.sampler);
+        job.integrator = tree.get("integrator", defaults.integrator);
+        job.shuffle = tree.get("shuffle", defaults.shuffle);
+        if(!readVector(tree, "lookFrom", job.lookFrom) || !readVector(tree, "lookAt", job.lookAt)){
+            error = "lookFrom and lookAt need three numbers";
+            return false;
+        }
+    }catch(const boost::property_tree::ptree_error& e){
+        error = e.what();
+        return false;
+    }
+    if(job.width <= 0 || job.height <= 0 || job.numRaysPixel <= 0){
+        error = "width, height and num-rays have to be positive";
+        return false;
+    }
+    if(job.width > maxImageSize || job.height > maxImageSize){
+        error = "width and height have to be at most " + std::to_string(maxImageSize);
+        return false;
+    }
+    if(!isRelativeFilename(job.filename)){
+        error = "filename has to be a relative path without '..'";
+        return false;
+    }
+    if(job.varA < 0 || job.varB < 0 || job.varA > maxSceneVar || job.varB > maxSceneVar){
+        error = "var-a and var-b have to be between 0 and " + std::to_string(maxSceneVar);
+        return false;
+    }
+    return true;
+}
+
+// A status line sent to the clients: a flat JSON object whose values keep
+// their types, unlike write_json of property_tree, which quotes everything.
+class ServerMessage{
+    public:
+        void put(const std::string& key, const std::string& value){
+            set(key, quote(value));
+        }
+
+        void put(const std::string& key, const char *value){
+            set(key, quote(value));
+        }
+
+        void put(const std::string& key, bool value){
+            set(key, value ? "true" : "false");
+        }
+
+        void put(const std::string& key, long value){
+            set(key, std::to_string(value));
+        }
+
+        void put(const std::string& key, double value){
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(1) << value;
+            set(key, text.str());
+        }
+
+        // One line of JSON, terminated by a newline.
+        std::string str() const{
+            std::string line = "{";
+            for(size_t i = 0; i < fields.size(); ++i){
+                if(i > 0)
+                    line += ",";
+                line += quote(fields[i].first) + ":" + fields[i].second;
+            }
+            return line + "}\n";
+        }
+
+    private:
+        void set(const std::string& key, const std::string& json){
+            for(size_t i = 0; i < fields.size(); ++i)
+                if(fields[i].first == key){
+                    fields[i].second = json;
+                    return;
+                }
+            fields.push_back(std::make_pair(key, json));
+        }
+
+        static std::string quote(const std::string& value){
+            std::string text = "\"";
+            for(size_t i = 0; i < value.size(); ++i){
+                unsigned char c = value[i];
+                if(c == '"' || c == '\\'){
+                    text += '\\';
+                    text += char(c);
+                }else if(c < 0x20){
+                    char escape[8];
+                    std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+                    text += escape;
+                }else{
+                    text += char(c);
+                }
+            }
+            return text + "\"";
+        }
+
+        // keys with their values already encoded as JSON
+        std::vector<std::pair<std::string, std::string> > fields;
+};
+
+// A client of the server, which receives one line of JSON per message.
+class ServerConnection{
+    public:
+        // A client that does not read its messages for this long is given up,
+        // so it cannot block the render thread.
+        static const int sendTimeoutSeconds = 10;
+
+        ServerConnection(int in, int out, bool socket) : in(in), out(out), socket(socket), broken(false){
+            if(socket){
+                timeval timeout = {sendTimeoutSeconds, 0};
+                setsockopt(out, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            }
+        }
+
+        ~ServerConnection(){
+            if(socket)
+                close(in);
+        }
+
+        void send(const ServerMessage& message){
+            std::string text = message.str();
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            for(size_t written = 0; written < text.size() && !broken;){
+                // a client that went away must not kill the server with SIGPIPE
+                ssize_t n = socket ? ::send(out, text.data() + written, text.size() - written, MSG_NOSIGNAL)
+                                   : ::write(out, text.data() + written, text.size() - written);
+                if(n <= 0){
+                    if(n < 0 && errno == EINTR)
+                        continue;
+                    broken = true;
+                    return;
+                }
+                written += n;
+            }
+        }
+
+        // Holds back the messages of other threads until the lock is released.
+        std::unique_lock<std::recursive_mutex> lockMessages(){
+            return std::unique_lock<std::recursive_mutex>(mutex);
+        }
+
+        // Makes a readLine waiting for a socket client return.
+        void interrupt(){
+            if(socket)
+                shutdown(in, SHUT_RD);
+        }
+
+        // Reads the next line, returns false at the end of the input.
+        bool readLine(std::string& line){
+            for(;;){
+                size_t end = buffer.find('\n');
+                if(end != std::string::npos){
+                    line = buffer.substr(0, end);
+                    buffer.erase(0, end + 1);
+                    return true;
+                }
+                char chunk[4096];
+                ssize_t n = ::read(in, chunk, sizeof(chunk));
+                if(n < 0 && errno == EINTR)
+                    continue;
+                if(n <= 0){
+                    line.swap(buffer);
+                    buffer.clear();
+                    return !line.empty();
+                }
+                buffer.append(chunk, n);
+            }
+        }
+
+    private:
+        int in;
+        int out;
+        bool socket;
+        bool broken;
+        std::string buffer;
+        std::recursive_mutex mutex;
+};
+
+// Long-running render server. Clients send jobs as lines of JSON over a Unix
+// domain socket or stdin and receive status lines: queued, started and done
+// or failed, each with the id of the job. The jobs are rendered one after the
+// other in order of priority, each by all threads of the process, so OpenMP's
+// threads, the scenes and their materials stay warm between jobs. A line
+// {"command": "shutdown"} stops the server once the queued jobs are done.
+class RenderServer{
+    public:
+        // run renders a job; it may add fields to the result message and sets
+        // error when it fails.
+        typedef std::function<bool(const RenderJob&, ServerMessage&, std::string&)> JobFunction;
+
+        RenderServer(const RenderJob& defaults, JobFunction run) : defaults(defaults), runJob(run), listenFd(-1), sequence(0), stopping(false){}
+
+        // Stops accepting clients, ends the connections and waits for their
+        // threads, which use the server until they return.
+        ~RenderServer(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                if(listenFd >= 0)
+                    shutdown(listenFd, SHUT_RDWR);
+                for(std::list<ClientThread>::iterator it = clients.begin(); it != clients.end(); ++it)
+                    it->client->interrupt();
+            }
+            if(acceptThread.joinable())
+                acceptThread.join();
+            for(std::list<ClientThread>::iterator it = clients.begin(); it != clients.end(); ++it)
+                it->thread.join();
+            if(listenFd >= 0){
+                close(listenFd);
+                unlink(path.c_str());
+            }
+        }
+
+        // Accepts clients on the Unix domain socket at socketPath. A stale
+        // socket left there is replaced, any other file is kept. Only the
+        // user running the server may connect, as jobs write files with its
+        // rights.
+        bool listen(const std::string& socketPath, std::string& error){
+            sockaddr_un address;
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if(socketPath.size() >= sizeof(address.sun_path)){
+                error = "socket path " + socketPath + " is too long";
+                return false;
+            }
+            std::strcpy(address.sun_path, socketPath.c_str());
+            struct stat status;
+            if(lstat(socketPath.c_str(), &status) == 0){
+                if(!S_ISSOCK(status.st_mode)){
+                    error = socketPath + " exists and is not a socket";
+                    return false;
+                }
+                unlink(socketPath.c_str());
+            }
+            listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            // bind creates the socket file with the umask; no other thread
+            // runs yet, so the umask is changed briefly to create it as 0600
+            mode_t mask = umask(0177);
+            bool bound = listenFd >= 0 && bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+            umask(mask);
+            if(!bound || ::listen(listenFd, 16) != 0){
+                error = "unable to listen on " + socketPath + ": " + std::strerror(errno);
+                return false;
+            }
+            path = socketPath;
+            acceptThread = std::thread(&RenderServer::accept, this);
+            return true;
+        }
+
+        // Reads jobs from stdin and answers on stdout; the server stops at the
+        // end of the input once all jobs are done.
+        void serveStdin(){
+            std::shared_ptr<ServerConnection> client(new ServerConnection(0, 1, false));
+            std::lock_guard<std::mutex> lock(mutex);
+            addClient(client, true);
+        }
+
+        // Renders the queued jobs until the server is stopped.
+        void run(){
+            for(;;){
+                QueuedJob queued;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [this]{ return !jobs.empty() || stopping; });
+                    if(jobs.empty())
+                        return;
+                    queued = jobs.top();
+                    jobs.pop();
+                }
+
+                queued.client->send(status(queued.job, "started"));
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::string error;
+                ServerMessage message = status(queued.job, "done");
+                bool ok;
+                // a job that throws fails alone instead of ending the server
+                try{
+                    ok = runJob(queued.job, message, error);
+                }catch(const std::exception& e){
+                    ok = false;
+                    error = e.what();
+                }
+                if(!ok){
+                    message = status(queued.job, "failed");
+                    message.put("error", error);
+                }
+                message.put("milliseconds", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                queued.client->send(message);
+            }
+        }
+
+    private:
+        struct ClientThread{
+            std::shared_ptr<ServerConnection> client;
+            std::thread thread;
+            bool done;
+        };
+
+        static ServerMessage status(const RenderJob& job, const std::string& state){
+            ServerMessage message;
+            message.put("id", job.id);
+            message.put("status", state);
+            return message;
+        }
+
+        // Starts the thread of a new client; needs the lock of mutex. The
+        // threads of clients that left are joined here.
+        void addClient(std::shared_ptr<ServerConnection> client, bool last){
+            for(std::list<ClientThread>::iterator it = clients.begin(); it != clients.end();){
+                if(it->done){
+                    it->thread.join();
+                    it = clients.erase(it);
+                }else{
+                    ++it;
+                }
+            }
+            clients.push_back(ClientThread());
+            ClientThread& entry = clients.back();
+            entry.client = client;
+            entry.done = false;
+            entry.thread = std::thread(&RenderServer::serve, this, client, &entry, last);
+        }
+
+        void accept(){
+            for(;;){
+                int fd = ::accept(listenFd, nullptr, nullptr);
+                if(fd < 0){
+                    if(errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    return;
+                }
+                std::shared_ptr<ServerConnection> client(new ServerConnection(fd, fd, true));
+                std::lock_guard<std::mutex> lock(mutex);
+                if(stopping)
+                    return;
+                addClient(client, false);
+            }
+        }
+
+        // Queues the jobs sent by client; stops the server at the end of the
+        // input if last is set.
+        void serve(std::shared_ptr<ServerConnection> client, ClientThread *self, bool last){
+            std::string line;
+            while(client->readLine(line)){
+                if(line.find_first_not_of(" \t\r") == std::string::npos)
+                    continue;
+                boost::property_tree::ptree tree;
+                std::string error;
+                try{
+                    std::istringstream in(line);
+                    boost::property_tree::read_json(in, tree);
+                }catch(const boost::property_tree::ptree_error& e){
+                    ServerMessage message;
+                    message.put("status", "failed");
+                    message.put("error", e.what());
+                    client->send(message);
+                    continue;
+                }
+
+                if(tree.get("command", "") == "shutdown"){
+                    stop();
+                    break;
+                }
+
+                QueuedJob queued;
+                if(!parseJob(tree, defaults, queued.job, error)){
+                    ServerMessage message = status(queued.job, "failed");
+                    message.put("error", error);
+                    client->send(message);
+                    continue;
+                }
+                queued.client = client;
+                // the queued line is sent before the worker can send started,
+                // but outside of the lock of the queue, so a client that does
+                // not read blocks neither the worker nor the other clients
+                std::unique_lock<std::recursive_mutex> order = client->lockMessages();
+                ServerMessage message = status(queued.job, "queued");
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(stopping)
+                        break;
+                    queued.sequence = sequence++;
+                    jobs.push(queued);
+                    message.put("queued", long(jobs.size()));
+                    changed.notify_all();
+                }
+                client->send(message);
+            }
+            if(last)
+                stop();
+            std::lock_guard<std::mutex> lock(mutex);
+            self->done = true;
+        }
+
+        void stop(){
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            if(listenFd >= 0)
+                shutdown(listenFd, SHUT_RDWR);
+            changed.notify_all();
+        }
+
+        RenderJob defaults;
+        JobFunction runJob;
+        std::string path;
+        int listenFd;
+        long sequence;
+        bool stopping;
+        std::priority_queue<QueuedJob> jobs;
+        std::thread acceptThread;
+        std::list<ClientThread> clients;
+        std::mutex mutex;
+        std::condition_variable changed;
+};
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef SHAREDFRAMEBUFFERH
+#define SHAREDFRAMEBUFFERH
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Layout of a shared framebuffer: the header, then tilesX * tilesY tile
+// versions, then the RGBA image with the top row first. A tile version is odd
+// while the tile is written and grows by two with every update, so a viewer
+// copies a tile between two reads of the same even version and only copies
+// the tiles whose versions changed since it last looked.
+struct SharedFramebufferHeader{
+    static const std::uint32_t magicValue = 0x42465253; // "SRFB"
+    static const std::uint32_t layoutVersion = 1;
+
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint32_t width;
+    std::uint32_t height;
+    std::uint32_t tileSize;
+    std::uint32_t tilesX;
+    std::uint32_t tilesY;
+    // set when the renderer has finished all frames
+    std::atomic<std::uint32_t> done;
+    std::uint64_t tileOffset;
+    std::uint64_t pixelOffset;
+    std::uint64_t size;
+    // number of the frame that is being rendered and of the finished frames
+    std::atomic<std::uint32_t> frame;
+    std::atomic<std::uint32_t> framesDone;
+};
+
+// Maps a shared framebuffer, either a POSIX shared memory object (a name like
+// /render without further slashes) or a memory-mapped file (any other path).
+class SharedFramebufferMapping{
+    public:
+        SharedFramebufferMapping() : header(nullptr), size(0){}
+
+        ~SharedFramebufferMapping(){
+            if(header)
+                munmap(header, size);
+        }
+
+        static bool isSharedMemoryName(const std::string& name){
+            return name.size() > 1 && name[0] == '/' && name.find('/', 1) == std::string::npos;
+        }
+
+        std::atomic<std::uint32_t>* tileVersions() const{
+            return reinterpret_cast<std::atomic<std::uint32_t>*>(reinterpret_cast<char*>(header) + header->tileOffset);
+        }
+
+        std::uint8_t* pixels() const{
+            return reinterpret_cast<std::uint8_t*>(header) + header->pixelOffset;
+        }
+
+        SharedFramebufferHeader *header;
+
+    protected:
+        int openFile(const std::string& name, int flags){
+            if(isSharedMemoryName(name))
+                return shm_open(name.c_str(), flags, 0644);
+            return ::open(name.c_str(), flags, 0644);
+        }
+
+        bool map(int fd, size_t bytes, int protection, std::string& error){
+            void *address = mmap(nullptr, bytes, protection, MAP_SHARED, fd, 0);
+            close(fd);
+            if(address == MAP_FAILED){
+                error = std::string("unable to map shared framebuffer: ") + std::strerror(errno);
+                return false;
+            }
+            header = static_cast<SharedFramebufferHeader*>(address);
+            size = bytes;
+            return true;
+        }
+
+        size_t size;
+};
+
+// Publishes the finished regions of the RGBA image to a shared framebuffer
+// that external viewers attach to. Publishing copies the pixels once, in the
+// thread that finished them; the render threads never wait for a viewer.
+class SharedFramebuffer : public SharedFramebufferMapping{
+    public:
+        static const int tileSize = 32;
+
+        // Marks the render as done; a shared memory object is removed, a
+        // file is kept with the last frame.
+        ~SharedFramebuffer(){
+            if(!header)
+                return;
+            header->done.store(1, std::memory_order_release);
+            if(isSharedMemoryName(name))
+                shm_unlink(name.c_str());
+        }
+
+        // Creates the shared framebuffer for an image of w x h pixels.
+        bool create(const std::string& name, const std::vector<std::uint8_t> *image, int w, int h, std::string& error){
+            this->name = name;
+            img = image;
+            width = w;
+            tilesX = (w + tileSize - 1) / tileSize;
+            tilesY = (h + tileSize - 1) / tileSize;
+            std::uint64_t tileOffset = (sizeof(SharedFramebufferHeader) + 63) & ~std::uint64_t(63);
+            std::uint64_t pixelOffset = (tileOffset + sizeof(std::uint32_t) * tilesX * tilesY + 63) & ~std::uint64_t(63);
+            std::uint64_t bytes = pixelOffset + std::uint64_t(w) * h * 4;
+
+            int fd = openFile(name, O_RDWR | O_CREAT | O_TRUNC);
+            if(fd < 0 || ftruncate(fd, bytes) != 0){
+                error = "unable to create shared framebuffer " + name + ": " + std::strerror(errno);
+                if(fd >= 0)
+                    close(fd);
+                return false;
+            }
+            if(!map(fd, bytes, PROT_READ | PROT_WRITE, error))
+                return false;
+
+            header->width = w;
+            header->height = h;
+            header->tileSize = tileSize;
+            header->tilesX = tilesX;
+            header->tilesY = tilesY;
+            header->done = 0;
+            header->tileOffset = tileOffset;
+            header->pixelOffset = pixelOffset;
+            header->size = bytes;
+            header->frame = 0;
+            header->framesDone = 0;
+            header->version = SharedFramebufferHeader::layoutVersion;
+            // the magic is written last, viewers wait for it
+            std::atomic_thread_fence(std::memory_order_release);
+            header->magic = SharedFramebufferHeader::magicValue;
+            return true;
+        }
+
+        void startFrame(int frame){
+            header->frame.store(frame, std::memory_order_release);
+        }
+
+        void finishFrame(){
+            header->framesDone.fetch_add(1, std::memory_order_release);
+        }
+
+        // Copies a finished rectangle of the image (the first row is the top)
+        // and bumps the versions of its tiles.
+        void publish(int x, int y, int w, int h){
+            std::atomic<std::uint32_t> *versions = tileVersions();
+            std::uint8_t *shared = pixels();
+            int tx0 = x / tileSize, tx1 = (x + w - 1) / tileSize;
+            int ty0 = y / tileSize, ty1 = (y + h - 1) / tileSize;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for(int ty = ty0; ty <= ty1; ++ty)
+                for(int tx = tx0; tx <= tx1; ++tx)
+                    versions[ty * tilesX + tx].fetch_add(1, std::memory_order_acq_rel);
+            std::atomic_thread_fence(std::memory_order_release);
+            for(int row = y; row < y + h; ++row){
+                size_t offset = (size_t(row) * width + x) * 4;
+                std::memcpy(shared + offset, &(*img)[offset], size_t(w) * 4);
+            }
+            std::atomic_thread_fence(std::memory_order_release);
+            for(int ty = ty0; ty <= ty1; ++ty)
+                for(int tx = tx0; tx <= tx1; ++tx)
+                    versions[ty * tilesX + tx].fetch_add(1, std::memory_order_release);
+        }
+
+    private:
+        std::string name;
+        const std::vector<std::uint8_t> *img;
+        int width;
+        int tilesX;
+        int tilesY;
+        std::mutex mutex;
+};
+
+// Attaches read-only to a shared framebuffer created by another process.
+class SharedFramebufferReader : public SharedFramebufferMapping{
+    public:
+        bool attach(const std::string& name, std::string& error){
+            int fd = openFile(name, O_RDONLY);
+            struct stat info;
+            if(fd < 0 || fstat(fd, &info) != 0){
+                error = "unable to open shared framebuffer " + name + ": " + std::strerror(errno);
+                if(fd >= 0)
+                    close(fd);
+                return false;
+            }
+            if(size_t(info.st_size) < sizeof(SharedFramebufferHeader)){
+                close(fd);
+                error = name + " is not a shared framebuffer";
+                return false;
+            }
+            if(!map(fd, info.st_size, PROT_READ, error))
+                return false;
+            if(header->magic != SharedFramebufferHeader::magicValue || header->version != SharedFramebufferHeader::layoutVersion || header->size > size){
+                error = name + " is not a shared framebuffer";
+                return false;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return true;
+        }
+
+        // Copies the tiles that changed since the last call into image (RGBA,
+        // the first row is the top) and returns their number. Tiles that are
+        // being written are retried on the next call.
+        int update(std::vector<std::uint8_t>& image){
+            int width = header->width, height = header->height, tileSize = header->tileSize;
+            int tilesX = header->tilesX, tilesY = header->tilesY;
+            image.resize(size_t(width) * height * 4);
+            seen.resize(size_t(tilesX) * tilesY, 0);
+            const std::atomic<std::uint32_t> *versions = tileVersions();
+            const std::uint8_t *shared = pixels();
+            int copied = 0;
+            for(int ty = 0; ty < tilesY; ++ty){
+                for(int tx = 0; tx < tilesX; ++tx){
+                    int tile = ty * tilesX + tx;
+                    std::uint32_t version = versions[tile].load(std::memory_order_acquire);
+                    if(version == seen[tile] || (version & 1))
+                        continue;
+                    int x0 = tx * tileSize, x1 = std::min(width, x0 + tileSize);
+                    int y0 = ty * tileSize, y1 = std::min(height, y0 + tileSize);
+                    for(int row = y0; row < y1; ++row){
+                        size_t offset = (size_t(row) * width + x0) * 4;
+                        std::memcpy(&image[offset], shared + offset, size_t(x1 - x0) * 4);
+                    }
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if(versions[tile].load(std::memory_order_relaxed) != version)
+                        continue;
+                    seen[tile] = version;
+                    ++copied;
+                }
+            }
+            return copied;
+        }
+
+    private:
+        std::vector<std::uint32_t> seen;
+};
+
+#endif
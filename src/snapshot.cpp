@@ -0,0 +1,49 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include "shared_framebuffer.h"
+#include "lodepng/lodepng.h"
+
+// Attaches to the shared framebuffer of a running render and saves its
+// current image as PNG, optionally whenever it changed, checking once per
+// interval until the render is done.
+// Also serves as an example of a viewer of the shared framebuffer.
+
+int main(int argc, const char *argv[])
+{
+    if(argc < 3){
+        std::cerr << "usage: " << argv[0] << " <shared framebuffer> <png file> [interval in ms]" << std::endl;
+        return 1;
+    }
+    std::string name = argv[1];
+    std::string filename = argv[2];
+    int interval = argc > 3 ? std::atoi(argv[3]) : 0;
+
+    SharedFramebufferReader reader;
+    std::string error;
+    if(!reader.attach(name, error)){
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    std::vector<std::uint8_t> image;
+    for(;;){
+        bool done = reader.header->done.load(std::memory_order_acquire);
+        int tiles = reader.update(image);
+        if(tiles > 0){
+            unsigned result = lodepng::encode(filename, image, reader.header->width, reader.header->height);
+            if(result){
+                std::cerr << "unable to write " << filename << ": " << lodepng_error_text(result) << std::endl;
+                return 1;
+            }
+            std::cout << "frame " << reader.header->frame << ": " << tiles << " tile(s) updated" << std::endl;
+        }
+        if(interval <= 0 || done)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+    }
+    return 0;
+}
@@ -15,7 +15,7 @@ class Sphere: public Surface{
         Material *mat;
 };
 
-bool Sphere::hit(const Ray& r, float tMin, float tMax, hitRecord& hitRec) const{
+inline bool Sphere::hit(const Ray& r, float tMin, float tMax, hitRecord& hitRec) const{
     vec3 oc = r.getOrigin() - position;
     float a = dot(r.getDirection(), r.getDirection());
     float b = dot(oc, r.getDirection());
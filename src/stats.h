@@ -0,0 +1,365 @@
+#ifndef STATSH
+#define STATSH
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <atomic>
+#include "perf_counters.h"
+
+// Counters of the hot paths for --stats. Every thread counts into its own
+// RenderCounters without synchronisation; the report adds them up. Building
+// with NO_STATS removes the counting from the hot paths, the phase times are
+// still measured. With --perf-counters the hardware counters of every thread
+// are read at the start and end of the phases as well.
+
+// Counted per MaterialType of material.h.
+const int statsMaterialTypes = 3;
+const char* const statsMaterialNames[statsMaterialTypes] = {"lambertian", "metal", "dielectric"};
+
+// Phases measured by the hardware counters. The wavefront integrator splits
+// the render into the primary rays and the secondary bounces of every tile.
+enum PerfPhase{
+    PHASE_SCENE,
+    PHASE_RENDER,
+    PHASE_PRIMARY,
+    PHASE_SECONDARY,
+    PHASE_ENCODE,
+    NUM_PERF_PHASES
+};
+
+const char* const perfPhaseNames[NUM_PERF_PHASES] = {"scene", "render", "primary rays", "secondary bounces", "encode"};
+
+struct RenderCounters{
+    // paths with more bounces are counted in the last bucket
+    static const int maxPathLength = 16;
+
+    RenderCounters() : primaryRays(0), secondaryRays(0), sphereTests(0), previewSeconds(0){
+        std::fill(scatterCalls, scatterCalls + statsMaterialTypes, 0);
+        std::fill(pathLengths, pathLengths + maxPathLength + 1, 0);
+    }
+
+    void merge(const RenderCounters& other){
+        primaryRays += other.primaryRays;
+        secondaryRays += other.secondaryRays;
+        sphereTests += other.sphereTests;
+        previewSeconds += other.previewSeconds;
+        for(int i = 0; i < statsMaterialTypes; ++i)
+            scatterCalls[i] += other.scatterCalls[i];
+        for(int i = 0; i <= maxPathLength; ++i)
+            pathLengths[i] += other.pathLengths[i];
+        for(int i = 0; i < NUM_PERF_PHASES; ++i)
+            perf[i].merge(other.perf[i]);
+    }
+
+    std::uint64_t primaryRays;
+    std::uint64_t secondaryRays;
+    std::uint64_t sphereTests;
+    std::uint64_t scatterCalls[statsMaterialTypes];
+    // number of surfaces a path hit before it left the scene or was absorbed
+    std::uint64_t pathLengths[maxPathLength + 1];
+    // time spent copying finished pixels for the preview
+    double previewSeconds;
+    PerfSample perf[NUM_PERF_PHASES];
+};
+
+// The counters of all threads and the times of the phases of a run.
+class RenderStats{
+    public:
+        static RenderStats& instance(){
+            static RenderStats stats;
+            return stats;
+        }
+
+        RenderStats() : perfEnabled(false){
+            for(int i = 0; i < NUM_COUNTERS; ++i)
+                perfAvailable[i] = false;
+        }
+
+        // Reads the hardware counters of every thread that calls
+        // threadPerfCounters from now on.
+        void enablePerfCounters(){
+            perfEnabled = true;
+        }
+
+        bool perfCountersEnabled() const{
+            return perfEnabled;
+        }
+
+        // Notes which counters a thread could open and why the others failed.
+        void addPerfCounters(const PerfCounters& counters, const std::string& error){
+            std::lock_guard<std::mutex> lock(mutex);
+            for(int i = 0; i < NUM_COUNTERS; ++i)
+                perfAvailable[i] = perfAvailable[i] || counters.isOpen(i);
+            if(perfError.empty())
+                perfError = error;
+        }
+
+        // Counters for a new thread; they live until the end of the process,
+        // so threads may end before the report.
+        RenderCounters* addThread(){
+            std::lock_guard<std::mutex> lock(mutex);
+            threads.push_back(std::unique_ptr<RenderCounters>(new RenderCounters()));
+            return threads.back().get();
+        }
+
+        void addPhase(const std::string& name, double seconds){
+            std::lock_guard<std::mutex> lock(mutex);
+            for(size_t i = 0; i < phases.size(); ++i){
+                if(phases[i].first == name){
+                    phases[i].second += seconds;
+                    return;
+                }
+            }
+            phases.push_back(std::make_pair(name, seconds));
+        }
+
+        double phaseSeconds(const std::string& name) const{
+            for(size_t i = 0; i < phases.size(); ++i)
+                if(phases[i].first == name)
+                    return phases[i].second;
+            return 0;
+        }
+
+        RenderCounters total() const{
+            RenderCounters sum;
+            for(size_t i = 0; i < threads.size(); ++i)
+                sum.merge(*threads[i]);
+            return sum;
+        }
+
+        void print(std::ostream& os) const{
+            std::lock_guard<std::mutex> lock(mutex);
+            std::ios::fmtflags flags = os.flags();
+            std::streamsize precision = os.precision();
+            RenderCounters sum = total();
+
+            os << std::fixed << std::setprecision(3);
+            os << "phase                  seconds" << std::endl;
+            for(size_t i = 0; i < phases.size(); ++i)
+                os << std::left << std::setw(16) << phases[i].first << std::right << std::setw(14) << phases[i].second << std::endl;
+            os << std::left << std::setw(16) << "preview copy" << std::right << std::setw(14) << sum.previewSeconds << "  (summed over threads)" << std::endl;
+#ifdef NO_STATS
+            os << "ray counters not compiled in (NO_STATS)" << std::endl;
+#else
+            double renderSeconds = phaseSeconds("render");
+            std::uint64_t rays = sum.primaryRays + sum.secondaryRays;
+            os << std::setprecision(2);
+            os << "rays             " << rays << " (" << sum.primaryRays << " primary, " << sum.secondaryRays << " secondary)";
+            if(renderSeconds > 0)
+                os << ", " << rays / renderSeconds * 1e-6 << " Mrays/s";
+            os << std::endl;
+            os << "sphere tests     " << sum.sphereTests;
+            if(rays > 0)
+                os << " (" << double(sum.sphereTests) / rays << " per ray)";
+            os << std::endl;
+            os << "scatter calls   ";
+            for(int i = 0; i < statsMaterialTypes; ++i)
+                os << " " << statsMaterialNames[i] << " " << sum.scatterCalls[i];
+            os << std::endl;
+            os << "path length      paths" << std::endl;
+            for(int i = 0; i <= RenderCounters::maxPathLength; ++i)
+                if(sum.pathLengths[i])
+                    os << std::setw(5) << i << (i == RenderCounters::maxPathLength ? "+" : " ") << std::setw(16) << sum.pathLengths[i] << std::endl;
+            os << "thread           rays      Mrays/s" << std::endl;
+            for(size_t i = 0; i < threads.size(); ++i){
+                std::uint64_t threadRays = threads[i]->primaryRays + threads[i]->secondaryRays;
+                if(!threadRays)
+                    continue;
+                os << std::setw(6) << i << std::setw(15) << threadRays << std::setw(13) << (renderSeconds > 0 ? threadRays / renderSeconds * 1e-6 : 0) << std::endl;
+            }
+#endif
+            if(perfEnabled)
+                printPerf(os, sum);
+            os.flags(flags);
+            os.precision(precision);
+        }
+
+        void printJson(std::ostream& os) const{
+            std::lock_guard<std::mutex> lock(mutex);
+            RenderCounters sum = total();
+            os << "{\n  \"phases\": {";
+            for(size_t i = 0; i < phases.size(); ++i)
+                os << (i ? ", " : "") << "\"" << phases[i].first << "\": " << phases[i].second;
+            os << "},\n  \"previewCopySeconds\": " << sum.previewSeconds;
+#ifndef NO_STATS
+            double renderSeconds = phaseSeconds("render");
+            os << ",\n  \"primaryRays\": " << sum.primaryRays;
+            os << ",\n  \"secondaryRays\": " << sum.secondaryRays;
+            os << ",\n  \"sphereTests\": " << sum.sphereTests;
+            os << ",\n  \"scatterCalls\": {";
+            for(int i = 0; i < statsMaterialTypes; ++i)
+                os << (i ? ", " : "") << "\"" << statsMaterialNames[i] << "\": " << sum.scatterCalls[i];
+            os << "},\n  \"pathLengths\": [";
+            for(int i = 0; i <= RenderCounters::maxPathLength; ++i)
+                os << (i ? ", " : "") << sum.pathLengths[i];
+            os << "],\n  \"threads\": [";
+            bool first = true;
+            for(size_t i = 0; i < threads.size(); ++i){
+                std::uint64_t threadRays = threads[i]->primaryRays + threads[i]->secondaryRays;
+                if(!threadRays)
+                    continue;
+                os << (first ? "" : ", ") << "{\"rays\": " << threadRays << ", \"raysPerSecond\": " << (renderSeconds > 0 ? threadRays / renderSeconds : 0) << "}";
+                first = false;
+            }
+            os << "]";
+#endif
+            if(perfEnabled){
+                os << ",\n  \"perfCounters\": {";
+                bool firstPhase = true;
+                for(int p = 0; p < NUM_PERF_PHASES; ++p){
+                    if(!hasPerf(sum.perf[p]))
+                        continue;
+                    os << (firstPhase ? "\n    " : ",\n    ") << "\"" << perfPhaseNames[p] << "\": {\"total\": ";
+                    printPerfJson(os, sum.perf[p]);
+                    os << ", \"threads\": [";
+                    bool firstThread = true;
+                    for(size_t i = 0; i < threads.size(); ++i){
+                        if(!hasPerf(threads[i]->perf[p]))
+                            continue;
+                        os << (firstThread ? "" : ", ") << "{\"thread\": " << i << ", \"counters\": ";
+                        printPerfJson(os, threads[i]->perf[p]);
+                        os << "}";
+                        firstThread = false;
+                    }
+                    os << "]}";
+                    firstPhase = false;
+                }
+                os << "\n  }";
+            }
+            os << "\n}" << std::endl;
+        }
+
+    private:
+        bool hasPerf(const PerfSample& sample) const{
+            for(int c = 0; c < NUM_COUNTERS; ++c)
+                if(sample.value[c] > 0)
+                    return true;
+            return false;
+        }
+
+        void printPerfRow(std::ostream& os, const std::string& phase, const std::string& thread, const PerfSample& sample) const{
+            os << std::left << std::setw(19) << phase << std::setw(7) << thread << std::right;
+            for(int c = 0; c < NUM_COUNTERS; ++c){
+                if(perfAvailable[c])
+                    os << std::setw(15) << std::uint64_t(sample.value[c]);
+                else
+                    os << std::setw(15) << "n/a";
+            }
+            if(perfAvailable[COUNTER_CYCLES] && perfAvailable[COUNTER_INSTRUCTIONS] && sample.value[COUNTER_CYCLES] > 0)
+                os << std::setw(7) << std::setprecision(2) << sample.value[COUNTER_INSTRUCTIONS] / sample.value[COUNTER_CYCLES];
+            os << std::endl;
+        }
+
+        // The counts of every phase, in total and per thread.
+        void printPerf(std::ostream& os, const RenderCounters& sum) const{
+            if(!perfError.empty())
+                os << "hardware counters: " << perfError << std::endl;
+            os << "phase              thread";
+            for(int c = 0; c < NUM_COUNTERS; ++c)
+                os << std::setw(15) << PerfCounters::name(c);
+            os << "    IPC" << std::endl;
+            for(int p = 0; p < NUM_PERF_PHASES; ++p){
+                if(!hasPerf(sum.perf[p]))
+                    continue;
+                printPerfRow(os, perfPhaseNames[p], "all", sum.perf[p]);
+                for(size_t i = 0; i < threads.size(); ++i)
+                    if(hasPerf(threads[i]->perf[p]) && threads.size() > 1)
+                        printPerfRow(os, "", std::to_string(i), threads[i]->perf[p]);
+            }
+        }
+
+        void printPerfJson(std::ostream& os, const PerfSample& sample) const{
+            os << "{";
+            bool first = true;
+            for(int c = 0; c < NUM_COUNTERS; ++c){
+                if(!perfAvailable[c])
+                    continue;
+                const char *keys[NUM_COUNTERS] = {"cycles", "instructions", "cacheMisses", "branchMisses", "taskClockNs"};
+                os << (first ? "" : ", ") << "\"" << keys[c] << "\": " << std::uint64_t(sample.value[c]);
+                first = false;
+            }
+            os << "}";
+        }
+
+        std::vector<std::unique_ptr<RenderCounters> > threads;
+        std::vector<std::pair<std::string, double> > phases;
+        std::atomic<bool> perfEnabled;
+        bool perfAvailable[NUM_COUNTERS];
+        std::string perfError;
+        mutable std::mutex mutex;
+};
+
+inline RenderCounters& threadCounters(){
+    static thread_local RenderCounters *counters = nullptr;
+    if(!counters)
+        counters = RenderStats::instance().addThread();
+    return *counters;
+}
+
+// The hardware counters of the calling thread, or nullptr if they are not
+// enabled or none of them is available.
+inline PerfCounters* threadPerfCounters(){
+    if(!RenderStats::instance().perfCountersEnabled())
+        return nullptr;
+    static thread_local std::unique_ptr<PerfCounters> counters;
+    static thread_local bool available = false;
+    if(!counters){
+        counters.reset(new PerfCounters());
+        std::string error;
+        available = counters->open(error);
+        RenderStats::instance().addPerfCounters(*counters, error);
+    }
+    return available ? counters.get() : nullptr;
+}
+
+#ifdef NO_STATS
+#define STATS_ADD(counter, n) ((void)0)
+#else
+#define STATS_ADD(counter, n) (threadCounters().counter += (n))
+#endif
+
+// Adds the time from construction to destruction to a phase.
+class ScopedPhase{
+    public:
+        ScopedPhase(const std::string& name) : name(name), start(std::chrono::steady_clock::now()){}
+
+        ~ScopedPhase(){
+            RenderStats::instance().addPhase(name, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+
+    private:
+        std::string name;
+        std::chrono::steady_clock::time_point start;
+};
+
+// Adds the hardware counts of the calling thread from construction to
+// destruction to a phase, unless enabled is false.
+class PerfScope{
+    public:
+        PerfScope(PerfPhase phase, bool enabled = true) : phase(phase), counters(enabled ? threadPerfCounters() : nullptr){
+            if(counters)
+                counters->read(start);
+        }
+
+        ~PerfScope(){
+            if(!counters)
+                return;
+            PerfCounters::Reading end;
+            counters->read(end);
+            PerfCounters::add(start, end, threadCounters().perf[phase]);
+        }
+
+    private:
+        PerfPhase phase;
+        PerfCounters *counters;
+        PerfCounters::Reading start;
+};
+
+#endif
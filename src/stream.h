@@ -0,0 +1,109 @@
+#ifndef STREAMH
+#define STREAMH
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "hdr.h"
+#include "stats.h"
+
+// Writes the rows of a frame while it is rendered. The frame is rendered in
+// bands of bandRows rows from the top to the bottom; every finished band is
+// handed to a writer thread, which gamma-corrects its rows for the image
+// writer and passes the linear radiance to the HDR writer, while the next
+// bands are rendered. A framebuffer holding bandsInFlight bands is enough,
+// rendering only waits when the writer is that far behind.
+class FrameStream{
+    public:
+        static const int bandRows = 16;
+        static const int bandsInFlight = 4;
+
+        // Either writer may be nullptr; both have to be opened already.
+        FrameStream(const Framebuffer *fb, ImageWriter *image, HdrWriter *hdr) : fb(fb), image(image), hdr(hdr), finished(false){
+            writer = std::thread(&FrameStream::run, this);
+        }
+
+        ~FrameStream(){
+            finish();
+        }
+
+        // Waits until the rows of the band starting at y0 are no longer
+        // needed by a band that is still being written.
+        void beginBand(int y0){
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this, y0]{
+                for(size_t i = 0; i < pending.size(); ++i)
+                    if(fb->index(0, pending[i]) == fb->index(0, y0))
+                        return false;
+                return true;
+            });
+        }
+
+        // Hands the finished band starting at y0 to the writer thread.
+        void endBand(int y0){
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(y0);
+            condition.notify_all();
+        }
+
+        // Waits until all bands are written.
+        void finish(){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(finished)
+                    return;
+                finished = true;
+                condition.notify_all();
+            }
+            writer.join();
+        }
+
+    private:
+        void run(){
+            std::vector<std::uint8_t> rgba(4 * size_t(fb->width));
+            for(;;){
+                int y0;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [this]{ return !pending.empty() || finished; });
+                    if(pending.empty())
+                        return;
+                    y0 = pending.front();
+                }
+
+                // the image is written from the top row downwards
+                PerfScope perf(PHASE_ENCODE);
+                for(int y = std::min(fb->height, y0 + bandRows) - 1; y >= y0; --y){
+                    const vec3 *row = &fb->radiance[fb->index(0, y)];
+                    if(image){
+                        for(int x = 0; x < fb->width; ++x)
+                            toRgba(row[x], &rgba[4*x]);
+                        image->writeRow(&rgba[0]);
+                    }
+                    if(hdr)
+                        hdr->writeRow(y, row);
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                pending.pop_front();
+                condition.notify_all();
+            }
+        }
+
+        const Framebuffer *fb;
+        ImageWriter *image;
+        HdrWriter *hdr;
+        bool finished;
+        std::deque<int> pending;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::thread writer;
+};
+
+#endif
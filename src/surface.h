@@ -10,10 +10,12 @@ struct hitRecord{
     vec3 p;
     vec3 normal;
     Material *mat;
+    int primitiveId;
 };
 
 class Surface{
     public:
+        virtual ~Surface(){}
         virtual bool hit(const Ray& r, float tMin, float tMax, hitRecord& hitRec) const = 0;
 };
 
@@ -2,6 +2,7 @@
 #define SURFACELISTH
 
 #include "surface.h"
+#include "stats.h"
 
 class SurfaceList: public Surface{
     public:
@@ -15,15 +16,17 @@ class SurfaceList: public Surface{
         int size;
 };
 
-bool SurfaceList::hit(const Ray& r, float tMin, float tMax, hitRecord& hitRec) const{
+inline bool SurfaceList::hit(const Ray& r, float tMin, float tMax, hitRecord& hitRec) const{
     hitRecord tempRec;
     bool hitAnything = false;
     float closestHit = tMax;
+    STATS_ADD(sphereTests, size);
     for(int i = 0; i < size; ++i){
         if(list[i]->hit(r, tMin, closestHit, tempRec)){
             hitAnything = true;
             closestHit = tempRec.t;
             hitRec = tempRec;
+            hitRec.primitiveId = i;
         }
 
     }
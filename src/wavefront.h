@@ -0,0 +1,401 @@
+#ifndef WAVEFRONTH
+#define WAVEFRONTH
+
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include "camera.h"
+#include "material.h"
+#include "surface.h"
+#include "integrator.h"
+#include "framebuffer.h"
+#include "stream.h"
+#include "preview.h"
+
+struct PathState{
+    Ray ray;
+    vec3 throughput;
+    hitRecord hitRec;
+    int x, y;
+    int pixel;
+    int sample;
+    int depth;
+};
+
+// Per-bounce counters of the wavefront integrator. Hit coherence is the share
+// of rays that hit the same object as the ray traced before them, a proxy for
+// how well the trace order reuses the cached scene data.
+struct WavefrontStats{
+    static const int maxBounces = 16;
+
+    WavefrontStats(){
+        for(int i = 0; i <= maxBounces; ++i){
+            rays[i] = 0;
+            coherentHits[i] = 0;
+            intersectSeconds[i] = 0;
+            sortSeconds[i] = 0;
+        }
+    }
+
+    void merge(const WavefrontStats& other){
+        for(int i = 0; i <= maxBounces; ++i){
+            rays[i] += other.rays[i];
+            coherentHits[i] += other.coherentHits[i];
+            intersectSeconds[i] += other.intersectSeconds[i];
+            sortSeconds[i] += other.sortSeconds[i];
+        }
+    }
+
+    // Times are summed over all threads, so the throughput is per thread.
+    void print(std::ostream& os) const{
+        std::ios::fmtflags flags = os.flags();
+        std::streamsize precision = os.precision();
+        os << "bounce        rays  hit coherence  Mrays/s/thread  sort ms  intersect ms" << std::endl;
+        for(int i = 0; i <= maxBounces; ++i){
+            if(!rays[i])
+                continue;
+            os << std::setw(5) << i << (i == maxBounces ? "+" : " ")
+               << std::setw(12) << rays[i]
+               << std::setw(14) << std::fixed << std::setprecision(3) << double(coherentHits[i]) / rays[i]
+               << std::setw(16) << std::setprecision(2) << rays[i] / (intersectSeconds[i] + sortSeconds[i]) * 1e-6
+               << std::setw(9) << std::setprecision(1) << sortSeconds[i] * 1e3
+               << std::setw(14) << intersectSeconds[i] * 1e3 << std::endl;
+        }
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+    uint64_t rays[maxBounces + 1];
+    uint64_t coherentHits[maxBounces + 1];
+    double intersectSeconds[maxBounces + 1];
+    double sortSeconds[maxBounces + 1];
+};
+
+// Breadth-first alternative to the recursive color(): all paths of a tile are
+// advanced one bounce at a time. Each bounce intersects the whole batch, sorts
+// the hits into one queue per material type and then shades every queue with
+// a non-virtual call of that material's scatter, so the shading loops run the
+// same code for all their paths. The loops stay scalar: every path draws its
+// samples through the virtual Sampler and the warps call sinf and cosf. The
+// result matches color() path by path.
+// With reordering enabled the scattered rays of every bounce are traced in
+// the order of their Morton-coded origins and direction octants, so that
+// rays close in space and direction are traced one after another.
+class WavefrontIntegrator{
+    public:
+        // Tiles with more samples than maxBatch paths are traced in several
+        // batches of samples.
+        static const int maxBatch = 1 << 14;
+
+        WavefrontIntegrator(Surface *s, const Camera& c, int w, int h, int n, bool r) : scene(s), cam(c), width(w), height(h), numRaysPixel(n), reorder(r){}
+
+        void renderTile(int x0, int y0, int x1, int y1, Sampler& sampler, std::vector<std::uint8_t> *img, Framebuffer *fb, PreviewBuffer *preview){
+            int tileWidth = x1 - x0;
+            int tilePixels = tileWidth * (y1 - y0);
+            radiance.assign(tilePixels, vec3(0, 0, 0));
+            features = fb->hasFeatures();
+            if(features)
+                pixelFeatures.assign(tilePixels, PixelFeatures());
+            cost = fb->hasCost();
+            std::chrono::steady_clock::time_point tileStart = std::chrono::steady_clock::now();
+            if(cost)
+                pixelRays.assign(tilePixels, 0);
+
+            int samplesPerBatch = std::max(1, maxBatch / tilePixels);
+            PerfCounters *perf = threadPerfCounters();
+            PerfCounters::Reading batchStart{}, primaryEnd{}, batchEnd{};
+            for(int s0 = 0; s0 < numRaysPixel; s0 += samplesPerBatch){
+                int s1 = std::min(numRaysPixel, s0 + samplesPerBatch);
+                bool primaryDone = false;
+                if(perf)
+                    perf->read(batchStart);
+                generate(x0, y0, tileWidth, tilePixels, s0, s1, sampler);
+                for(int bounce = 0; !active.empty(); ++bounce){
+                    if(perf && bounce == 1){
+                        perf->read(primaryEnd);
+                        primaryDone = true;
+                    }
+                    int slot = std::min(bounce, int(WavefrontStats::maxBounces));
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    if(reorder && bounce > 0)
+                        sortActive();
+                    std::chrono::steady_clock::time_point sorted = std::chrono::steady_clock::now();
+                    intersect(slot);
+                    stats.sortSeconds[slot] += std::chrono::duration<double>(sorted - start).count();
+                    stats.intersectSeconds[slot] += std::chrono::duration<double>(std::chrono::steady_clock::now() - sorted).count();
+                    shadeMisses();
+                    next.clear();
+                    shade<Lambertian>(queues[LAMBERTIAN], sampler);
+                    shade<Metal>(queues[METAL], sampler);
+                    shade<Dielectric>(queues[DIELECTRIC], sampler);
+                    active.swap(next);
+                }
+                if(perf){
+                    perf->read(batchEnd);
+                    // all paths may end at the first bounce
+                    if(!primaryDone)
+                        primaryEnd = batchEnd;
+                    PerfCounters::add(batchStart, primaryEnd, threadCounters().perf[PHASE_PRIMARY]);
+                    PerfCounters::add(primaryEnd, batchEnd, threadCounters().perf[PHASE_SECONDARY]);
+                }
+            }
+
+            // the paths of a tile are traced together, so the time of the
+            // tile is shared among its pixels by the number of their rays
+            float secondsPerRay = 0;
+            if(cost){
+                float tileSeconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - tileStart).count();
+                secondsPerRay = tileSeconds / std::max(1, std::accumulate(pixelRays.begin(), pixelRays.end(), 0));
+            }
+            for(int i = 0; i < tilePixels; ++i){
+                int x = x0 + i % tileWidth;
+                int y = y0 + i / tileWidth;
+                vec3 col = radiance[i] / float(numRaysPixel);
+                fb->radiance[fb->index(x, y)] = col;
+                if(features)
+                    fb->setFeatures(x, y, pixelFeatures[i]);
+                if(cost)
+                    fb->setCost(x, y, secondsPerRay * pixelRays[i], pixelRays[i]);
+                storePixel(img, width, height, x, y, col);
+            }
+            if(preview)
+                preview->publish(x0, height - y1, tileWidth, y1 - y0);
+        }
+
+        WavefrontStats stats;
+
+    private:
+        void generate(int x0, int y0, int tileWidth, int tilePixels, int s0, int s1, Sampler& sampler){
+            paths.resize(tilePixels * (s1 - s0));
+            if(features)
+                pathFeatures.resize(paths.size());
+            active.clear();
+            int k = 0;
+            for(int i = 0; i < tilePixels; ++i){
+                for(int s = s0; s < s1; ++s, ++k){
+                    PathState& path = paths[k];
+                    path.x = x0 + i % tileWidth;
+                    path.y = y0 + i / tileWidth;
+                    path.pixel = i;
+                    path.sample = s;
+                    path.depth = 0;
+                    path.throughput = vec3(1, 1, 1);
+                    if(features)
+                        pathFeatures[k].start();
+                    sampler.startPixelSample(path.x, path.y, s);
+                    float du, dv;
+                    sampler.get2D(du, dv);
+                    float u = float(path.x + du) / float(width);
+                    float v = float(path.y + dv) / float(height);
+                    path.ray = cam.getRay(u, v, sampler);
+                    active.push_back(k);
+                }
+            }
+        }
+
+        void intersect(int slot){
+            misses.clear();
+            for(int m = 0; m < NUM_MATERIAL_TYPES; ++m)
+                queues[m].clear();
+            const Material *previous = nullptr;
+            uint64_t coherent = 0;
+            for(size_t k = 0; k < active.size(); ++k){
+                PathState& path = paths[active[k]];
+                if(cost)
+                    ++pixelRays[path.pixel];
+                if(scene->hit(path.ray, 0.001, MAXFLOAT, path.hitRec)){
+                    coherent += path.hitRec.mat == previous;
+                    previous = path.hitRec.mat;
+                    queues[path.hitRec.mat->getType()].push_back(active[k]);
+                }else{
+                    coherent += previous == nullptr;
+                    previous = nullptr;
+                    misses.push_back(active[k]);
+                }
+            }
+            stats.rays[slot] += active.size();
+            if(slot == 0)
+                STATS_ADD(primaryRays, active.size());
+            else
+                STATS_ADD(secondaryRays, active.size());
+            stats.coherentHits[slot] += coherent;
+        }
+
+        static uint32_t expandBits(uint32_t v){
+            v = (v * 0x00010001U) & 0xFF0000FFU;
+            v = (v * 0x00000101U) & 0x0F00F00FU;
+            v = (v * 0x00000011U) & 0xC30C30C3U;
+            v = (v * 0x00000005U) & 0x49249249U;
+            return v;
+        }
+
+        // Sorts the active paths by direction octant and then by the 30 bit
+        // Morton code of their origin within the bounds of the batch.
+        void sortActive(){
+            vec3 lower(MAXFLOAT, MAXFLOAT, MAXFLOAT);
+            vec3 upper(-MAXFLOAT, -MAXFLOAT, -MAXFLOAT);
+            for(size_t k = 0; k < active.size(); ++k){
+                const vec3& o = paths[active[k]].ray.origin;
+                for(int a = 0; a < 3; ++a){
+                    lower[a] = std::min(lower[a], o[a]);
+                    upper[a] = std::max(upper[a], o[a]);
+                }
+            }
+            vec3 extent = upper - lower;
+            vec3 scale(extent[0] > 0 ? 1023.0f / extent[0] : 0, extent[1] > 0 ? 1023.0f / extent[1] : 0, extent[2] > 0 ? 1023.0f / extent[2] : 0);
+
+            keys.resize(active.size());
+            for(size_t k = 0; k < active.size(); ++k){
+                const Ray& r = paths[active[k]].ray;
+                vec3 q = (r.origin - lower) * scale;
+                uint32_t morton = (expandBits(uint32_t(q[0])) << 2) | (expandBits(uint32_t(q[1])) << 1) | expandBits(uint32_t(q[2]));
+                uint32_t octant = (r.direction[0] < 0) << 2 | (r.direction[1] < 0) << 1 | (r.direction[2] < 0);
+                keys[k] = std::make_pair(uint64_t(octant) << 30 | morton, active[k]);
+            }
+            std::sort(keys.begin(), keys.end());
+            for(size_t k = 0; k < active.size(); ++k)
+                active[k] = keys[k].second;
+        }
+
+        void shadeMisses(){
+            for(size_t k = 0; k < misses.size(); ++k){
+                const PathState& path = paths[misses[k]];
+                radiance[path.pixel] += path.throughput * skyColor(path.ray);
+                STATS_ADD(pathLengths[std::min(path.depth, int(RenderCounters::maxPathLength))], 1);
+                if(features){
+                    pathFeatures[misses[k]].miss(path.ray);
+                    pixelFeatures[path.pixel].add(pathFeatures[misses[k]], path.sample);
+                }
+            }
+        }
+
+        template<typename M>
+        void shade(const std::vector<int>& queue, Sampler& sampler){
+            for(size_t k = 0; k < queue.size(); ++k){
+                PathState& path = paths[queue[k]];
+                const M *mat = static_cast<const M*>(path.hitRec.mat);
+                Ray scattered;
+                vec3 attenuation(0, 0, 0);
+                bool alive = false;
+                if(path.depth < maxDepth){
+                    sampler.startPixelSample(path.x, path.y, path.sample);
+                    sampler.startBounce(path.depth);
+                    STATS_ADD(scatterCalls[mat->M::getType()], 1);
+                    alive = mat->M::scatter(path.ray, path.hitRec, attenuation, scattered, sampler);
+                }
+                if(features){
+                    pathFeatures[queue[k]].hitSurface(path.ray, path.hitRec, path.depth, alive, attenuation);
+                    if(!alive)
+                        pixelFeatures[path.pixel].add(pathFeatures[queue[k]], path.sample);
+                }
+                if(alive){
+                    path.throughput *= attenuation;
+                    path.ray = scattered;
+                    ++path.depth;
+                    next.push_back(queue[k]);
+                }else{
+                    STATS_ADD(pathLengths[std::min(path.depth + 1, int(RenderCounters::maxPathLength))], 1);
+                }
+            }
+        }
+
+        Surface *scene;
+        Camera cam;
+        int width;
+        int height;
+        int numRaysPixel;
+        bool reorder;
+
+        std::vector<PathState> paths;
+        std::vector<std::pair<uint64_t, int> > keys;
+        std::vector<vec3> radiance;
+        bool features;
+        std::vector<PathFeatures> pathFeatures;
+        std::vector<PixelFeatures> pixelFeatures;
+        bool cost;
+        std::vector<int> pixelRays;
+        std::vector<int> active;
+        std::vector<int> next;
+        std::vector<int> misses;
+        std::vector<int> queues[NUM_MATERIAL_TYPES];
+};
+
+// Renders the image tile by tile with one WavefrontIntegrator per thread. The
+// counters of all threads are added to stats if it is given. Pixels outside
+// region are black.
+inline void renderWavefront(std::vector<std::uint8_t> *img, Framebuffer *fb, int width, int height, int numRaysPixel, Surface* scene, const Camera& cam, bool shuffle, const Sampler& samplerPrototype, bool reorder, WavefrontStats *stats, FrameStream *stream, PreviewBuffer *preview, const PixelRegion& region)
+{
+    const int tileSize = 16;
+    int tilesX = (width + tileSize - 1) / tileSize;
+    int tilesY = (height + tileSize - 1) / tileSize;
+    // a streamed frame is rendered in bands of tile rows from the top
+    int bandTiles = stream ? FrameStream::bandRows / tileSize : tilesY;
+    std::vector<int> tiles(tilesX * bandTiles);
+    for(size_t i = 0; i < tiles.size(); ++i)
+        tiles[i] = i;
+
+    #pragma omp parallel
+    {
+        std::unique_ptr<Sampler> sampler(samplerPrototype.clone());
+        PerfScope perf(PHASE_RENDER);
+        WavefrontIntegrator integrator(scene, cam, width, height, numRaysPixel, reorder);
+
+        int numBands = (tilesY + bandTiles - 1) / bandTiles;
+        for(int b = numBands - 1; b >= 0; --b){
+            int band = b * bandTiles;
+            int bandSize = tilesX * std::min(bandTiles, tilesY - band);
+
+            #pragma omp single
+            {
+                if(stream)
+                    stream->beginBand(band * tileSize);
+                if(shuffle){
+                    std::iota(tiles.begin(), tiles.begin() + bandSize, 0);
+                    std::random_shuffle(tiles.begin(), tiles.begin() + bandSize);
+                }
+            }
+
+            #pragma omp for schedule(dynamic)
+            for(int i = 0; i < bandSize; ++i){
+                int tx = tiles[i] % tilesX;
+                int ty = band + tiles[i] / tilesX;
+                int x0 = tx * tileSize, x1 = std::min(width, x0 + tileSize);
+                int y0 = ty * tileSize, y1 = std::min(height, y0 + tileSize);
+                int rx0 = std::max(x0, region.x0), rx1 = std::min(x1, region.x1);
+                int ry0 = std::max(y0, region.y0), ry1 = std::min(y1, region.y1);
+                if(rx0 != x0 || rx1 != x1 || ry0 != y0 || ry1 != y1){
+                    for(int y = y0; y < y1; ++y)
+                        for(int x = x0; x < x1; ++x){
+                            fb->radiance[fb->index(x, y)] = vec3(0, 0, 0);
+                            if(fb->hasFeatures())
+                                fb->clearFeatures(x, y);
+                            if(fb->hasCost())
+                                fb->setCost(x, y, 0, 0);
+                            storePixel(img, width, height, x, y, vec3(0, 0, 0));
+                        }
+                    // renderTile only publishes the part inside the region
+                    if(preview)
+                        preview->publish(x0, height - y1, x1 - x0, y1 - y0);
+                }
+                if(rx0 < rx1 && ry0 < ry1)
+                    integrator.renderTile(rx0, ry0, rx1, ry1, *sampler, img, fb, preview);
+            }
+
+            #pragma omp single
+            if(stream)
+                stream->endBand(band * tileSize);
+        }
+
+        if(stats){
+            #pragma omp critical
+            stats->merge(integrator.stats);
+        }
+    }
+}
+
+#endif